@@ -689,6 +689,29 @@ void PairAligner::cigarToPAF(const cigar& final_cigar, const std::vector<Sequenc
 	logger.info() << paf_filename << " saved successfully!" << std::endl;
 }
 
+// The samples are aligned one after another like a single interval of alignIntervalsUsingWavefront,
+// including the creation of the aligner and the conversion of its CIGAR.
+void PairAligner::measureWavefrontCost(const std::vector<SequenceInfo>& data, const Intervals& samples, double& task_ns, double& cell_ns) {
+	std::vector<double> cells, nanoseconds;
+	for (const Interval& sample : samples) {
+		std::string seq1 = data[0].sequence.substr(sample.pos1, sample.len1);
+		std::string seq2 = data[1].sequence.substr(sample.pos2, sample.len2);
+		auto start = std::chrono::steady_clock::now();
+		wavefront_aligner_t* const wf_aligner = wavefront_aligner_new(&attributes);
+		wavefront_align(wf_aligner, seq1.c_str(), seq1.length(), seq2.c_str(), seq2.length());
+		uint32_t* cigar_buffer;
+		int cigar_length;
+		cigar_get_CIGAR(wf_aligner->cigar, true, &cigar_buffer, &cigar_length);
+		cigar sample_cigar = convertToCigarVector(cigar_buffer, cigar_length);
+		wavefront_aligner_delete(wf_aligner);
+		nanoseconds.emplace_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+		cells.emplace_back((double)sample.len1 * sample.len2);
+	}
+	RecursionCostModel::fitLine(cells, nanoseconds, task_ns, cell_ns);
+	logger.info() << "The wavefront alignment of " << samples.size() << " sample intervals takes " << task_ns << " ns per interval and "
+		<< cell_ns << " ns per cell" << std::endl;
+}
+
 // Function to align sequences within specified intervals using the wavefront alignment method.
 void PairAligner::alignIntervalsUsingWavefront(const std::vector<SequenceInfo>& data, const Intervals& intervals_need_align, std::vector<uint_t>& aligned_intervals_index, cigars& aligned_interval_cigar) {
 	ThreadPool pool(thread_num); // Create a thread pool with the determined number of threads.
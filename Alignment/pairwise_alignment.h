@@ -94,6 +94,9 @@ public:
 	// Constructor to initialize the PairAligner with scoring parameters and parallel processing flag.
 	explicit PairAligner(std::string save_file_path, int_t match = 0, int_t mismatch = 3, int_t gap_open1 = 4, int_t gap_extension1 = 2, int_t gap_open2 = 12, int_t gap_extension2 = 1, uint_t thread_num = 0);
 
+	// Time the wavefront alignment of sample intervals and fit its cost per interval and per cell.
+	void measureWavefrontCost(const std::vector<SequenceInfo>& data, const Intervals& samples, double& task_ns, double& cell_ns);
+
 	// Perform pairwise sequence alignment using provided data and optional anchors.
 	void alignPairSeq(const std::vector<SequenceInfo>& data, RareMatchPairs anchors = {}, bool sam_output = false, bool paf_output = false);
 
@@ -20,11 +20,65 @@
 
 #include "RMQ.h"
 
+#include <atomic>
+#include <chrono>
+#include <time.h>
+
+// Number of chunks per thread of each parallel loop, so that threads finishing early take more chunks.
+#define ST_CHUNKS_PER_THREAD 4
+
+// Returns the CPU time consumed by the calling thread in nanoseconds.
+static uint64_t threadCPUTime() {
+	timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// One thread pool shared by all phases of the parallel construction. Every loop is split into
+// chunks of blocks, and the CPU time spent in the chunks is summed up to report the parallel
+// utilisation, the CPU time per wall-clock second. It is not a speedup over the serial build.
+struct ParallelBuild {
+	ThreadPool pool;
+	uint_t parts;
+	std::atomic<uint64_t> busy_ns;
+
+	explicit ParallelBuild(uint_t thread_num) : pool(thread_num), parts(thread_num * ST_CHUNKS_PER_THREAD), busy_ns(0) {}
+
+	// Runs func(begin, end) over [0, n) and waits until all chunks are done
+	template<typename F>
+	void run(uint_t n, const F& func) {
+		parallelFor(pool, parts, n, [this, &func](uint_t begin, uint_t end) {
+			uint64_t start = threadCPUTime();
+			func(begin, end);
+			busy_ns += threadCPUTime() - start;
+			});
+	}
+};
+
+bool parseRMQType(const std::string& name, RMQType& type) {
+	if (name == "sparse") {
+		type = RMQType::SPARSE_TABLE;
+		return true;
+	}
+	if (name == "succinct") {
+		type = RMQType::SUCCINCT;
+		return true;
+	}
+	return false;
+}
+
+std::string RMQTypeName(RMQType type) {
+	switch (type) {
+	case RMQType::SUCCINCT: return "succinct";
+	default: return "sparse";
+	}
+}
+
 void LinearSparseTable::buildST() {
 	// Initialize the first level of the sparse table with minimum values within each block
 	int_t cur = 0, id = 1;
 	for (uint_t i = 1; i <= N; ++i) {
-		st[id][0] = getMinValue(st[id][0], (uint_t)LCP[i - 1]);
+		st[id] = getMinValue(st[id], (uint_t)(*LCP)[i - 1]);
 		belong[i] = id;
 		pos[i] = cur;
 		if (++cur == static_cast<int_t>(block_size)) {
@@ -32,68 +86,81 @@ void LinearSparseTable::buildST() {
 			++id;
 		}
 	}
-	// Build the rest of the sparse table for efficient range minimum queries
+	// Build the rest of the sparse table for efficient range minimum queries.
+	// Each level only reads the previous one, both are scanned sequentially.
 	for (uint_t i = 1; i <= log[block_num]; ++i) {
+		uint_t* level = &st[i * row_stride];
+		const uint_t* prev = &st[(i - 1) * row_stride];
 		for (int_t j = 1; j + pow[i] - 1 <= block_num; ++j) {
-			st[j][i] = getMinValue(st[j][i - 1], st[j + pow[i - 1]][i - 1]);
+			level[j] = getMinValue(prev[j], prev[j + pow[i - 1]]);
 		}
 	}
 }
 
 
+// Parallel version of buildST. The block minima are computed per chunk of blocks,
+// then every level of the sparse table is computed in parallel from the previous level.
+void LinearSparseTable::buildSTParallel(ParallelBuild& build) {
+	build.run(block_num, [this](uint_t first, uint_t last) {
+		for (uint_t block = first; block < last; ++block) {
+			uint_t id = block + 1;
+			uint_t start = block * block_size + 1;
+			uint_t end = getMinValue((block + 1) * block_size, N);
+			for (uint_t i = start; i <= end; ++i) {
+				st[id] = getMinValue(st[id], (uint_t)(*LCP)[i - 1]);
+				belong[i] = id;
+				pos[i] = i - start;
+			}
+		}
+		});
+	for (uint_t i = 1; i <= log[block_num]; ++i) {
+		uint_t* level = &st[i * row_stride];
+		const uint_t* prev = &st[(i - 1) * row_stride];
+		uint_t half = pow[i - 1];
+		// Entries j = 1 .. block_num - 2^i + 1 of this level are valid
+		build.run(block_num - pow[i] + 1, [level, prev, half](uint_t first, uint_t last) {
+			for (uint_t j = first + 1; j <= last; ++j) {
+				level[j] = getMinValue(prev[j], prev[j + half]);
+			}
+			});
+	}
+}
+
 void LinearSparseTable::buildSubPre() {
 	// Precompute minimum values for LCP within each block
 	for (uint_t i = 1; i <= N; ++i) {
 		if (belong[i] != belong[i - 1])
-			pre[i] = LCP[i - 1];
+			pre[i] = (*LCP)[i - 1];
 		else {
-			pre[i] = getMinValue(pre[i - 1], (uint_t)LCP[i - 1]);
+			pre[i] = getMinValue(pre[i - 1], (uint_t)(*LCP)[i - 1]);
 		}
 
 	}
 	// Precompute minimum values for LCP within each block in reverse order
 	for (uint_t i = N; i >= 1; --i) {
 		if (i + 1 > N || belong[i] != belong[i + 1])
-			sub[i] = LCP[i - 1];
+			sub[i] = (*LCP)[i - 1];
 		else
-			sub[i] = getMinValue(sub[i + 1], (uint_t)LCP[i - 1]);
+			sub[i] = getMinValue(sub[i + 1], (uint_t)(*LCP)[i - 1]);
 	}
 }
 
-void LinearSparseTable::buildSubPreParallel(uint_t thread_num) {
-	// Parallel version of buildSubPre using a thread pool for concurrency
-	ThreadPool pool(thread_num);
-
-	for (uint_t block = 0; block < block_num; ++block) {
-		pool.enqueue([this, block]() {
-			uint_t start = block * block_size + 1;
-			uint_t end = std::min((block + 1) * block_size, N);
-
-			for (uint_t i = start; i <= end; ++i) {
-				if (i == start || belong[i] != belong[i - 1])
-					pre[i] = LCP[i - 1];
-				else
-					pre[i] = getMinValue(pre[i - 1], (uint_t)LCP[i - 1]);
-			}
-
-			});
-	}
-
-	for (uint_t block = 0; block < block_num; ++block) {
-		pool.enqueue([this, block]() {
+void LinearSparseTable::buildSubPreParallel(ParallelBuild& build) {
+	// Parallel version of buildSubPre, every chunk of blocks is processed by one task
+	build.run(block_num, [this](uint_t first, uint_t last) {
+		for (uint_t block = first; block < last; ++block) {
 			uint_t start = block * block_size + 1;
 			uint_t end = std::min((block + 1) * block_size, N);
 
-			for (int_t i = static_cast<int_t>(end); i >= static_cast<int_t>(start); --i) {
-				if (i == static_cast<int_t>(end) || i + 1 > N || belong[i] != belong[i + 1])
-					sub[i] = LCP[i - 1];
-				else
-					sub[i] = getMinValue(sub[i + 1], (uint_t)LCP[i - 1]);
-			}
-			});
-	}
+			pre[start] = (*LCP)[start - 1];
+			for (uint_t i = start + 1; i <= end; ++i)
+				pre[i] = getMinValue(pre[i - 1], (uint_t)(*LCP)[i - 1]);
 
-	pool.waitAllTasksDone();
+			sub[end] = (*LCP)[end - 1];
+			for (uint_t i = end - 1; i >= start; --i)
+				sub[i] = getMinValue(sub[i + 1], (uint_t)(*LCP)[i - 1]);
+		}
+		});
 }
 
 // Sequentially constructs block information for LinearSparseTable
@@ -109,7 +176,7 @@ void LinearSparseTable::buildBlock() {
 		if (pos[i] == 0) top = 0;
 		else f[i] = f[i - 1];
 		// Maintain monotonicity of the stack
-		while (top > 0 && LCP[s[top] - 1] >= LCP[i - 1])
+		while (top > 0 && (*LCP)[s[top] - 1] >= (*LCP)[i - 1])
 			f[i] &= ~(bit << pos[s[top--]]); // Use bit manipulation to update f
 		s[++top] = i; // Push current index onto stack
 		f[i] |= (bit << pos[i]); // Set bit corresponding to current position
@@ -119,42 +186,35 @@ void LinearSparseTable::buildBlock() {
 //Parallel version of buildBlock using a thread pool for concurrency
 //This method parallelizes the block-based LinearSparseTable preprocessing by dividing the sequence into chunks
 //and processing each chunk in parallel, reducing overall computation time on multicore systems.
-void LinearSparseTable::buildBlockParallel(uint_t thread_num) {
-	ThreadPool pool(thread_num); // Create a thread pool
-
-	for (uint_t start = 1; start <= N; start += block_size) {
-		pool.enqueue([this, start] {
-			uint_t end = getMinValue(start + block_size - 1, N); // Determine block end
-			int_t top = 0; // Stack pointer
-			std::vector<int_t> s(block_size + 1, 0); // Monotone stack
-			uint64_t bit = 1;
-			for (uint_t i = start; i <= end; ++i) {
-				// Reset stack for each new block
-				if (pos[i] == 0) top = 0;
-				else f[i] = f[i - 1];
-				// Maintain monotonicity of the stack
-				while (top > 0 && LCP[s[top] - 1] >= LCP[i - 1])
-					f[i] &= ~(bit << pos[s[top--]]); // Use bit manipulation to update f
-				s[++top] = i; // Push current index onto stack
-				f[i] |= (bit << pos[i]); // Set bit corresponding to current position
-			}
-			});
-	}
-
-	pool.waitAllTasksDone(); // Wait for all tasks to complete
+void LinearSparseTable::buildBlockParallel(ParallelBuild& build) {
+	build.run(block_num, [this](uint_t first, uint_t last) {
+		int_t top = 0; // Stack pointer
+		std::vector<int_t> s(block_size + 1, 0); // Monotone stack
+		uint64_t bit = 1;
+		for (uint_t i = first * block_size + 1; i <= getMinValue(last * block_size, N); ++i) {
+			// Reset stack for each new block
+			if (pos[i] == 0) top = 0;
+			else f[i] = f[i - 1];
+			// Maintain monotonicity of the stack
+			while (top > 0 && (*LCP)[s[top] - 1] >= (*LCP)[i - 1])
+				f[i] &= ~(bit << pos[s[top--]]); // Use bit manipulation to update f
+			s[++top] = i; // Push current index onto stack
+			f[i] |= (bit << pos[i]); // Set bit corresponding to current position
+		}
+		});
 }
 
-LinearSparseTable::LinearSparseTable(int_t* a, uint_t n, uint_t thread_num) {
+LinearSparseTable::LinearSparseTable(const CompressedLCP* a, uint_t n, uint_t thread_num) {
 	LCP = a; // Directly use the provided array for LCP values
 	N = n; // Set the total number of elements
 	// Initialize vectors with appropriate sizes and default values
-	belong.resize(N + 1, 0);
-	pos.resize(N + 1, 0);
-	pow.resize(MAXM, 0);
-	log.resize(N + 1, 0);
-	pre.resize(N + 1, 0);
-	sub.resize(N + 1, 0);
-	f.resize(N + 1, 0);
+	belong.assign(N + 1, 0);
+	pos.assign(N + 1, 0);
+	pow.assign(MAXM, 0);
+	log.assign(N + 1, 0);
+	pre.assign(N + 1, 0);
+	sub.assign(N + 1, 0);
+	f.assign(N + 1, 0);
 
 	// Calculate block size and number of blocks based on input size
 	block_size = getMinValue((int)(log2(N) * 1.5), 63);
@@ -166,15 +226,27 @@ LinearSparseTable::LinearSparseTable(int_t* a, uint_t n, uint_t thread_num) {
 	for (uint_t i = 2; i <= block_num; ++i) log[i] = log[i / 2] + 1;
 
 	// Initialize sparse table with maximum values
-	st.resize(block_num + 1);
-	for (uint_t i = 0; i < st.size(); ++i) {
-		st[i].resize(log[block_num] + 1, U_MAX);
-	}
+	level_num = log[block_num] + 1;
+	row_stride = ((size_t)block_num + 1 + ST_ROW_ALIGN - 1) / ST_ROW_ALIGN * ST_ROW_ALIGN;
+	st.assign(level_num * row_stride, U_MAX);
 
 	// Build the sparse table and preprocess LCP array
-	buildST();
-	buildSubPre();
-	buildBlock();
+	if (thread_num > 1) {
+		auto start = std::chrono::steady_clock::now();
+		ParallelBuild build(thread_num);
+		buildSTParallel(build);
+		buildSubPreParallel(build);
+		buildBlockParallel(build);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		double busy = build.busy_ns / 1e9;
+		logger.info() << "The sparse table is built with " << thread_num << " threads in " << seconds << " s, "
+			<< busy << " s of CPU time (utilisation " << busy / getMaxValue(seconds, 1e-9) << " CPU/wall)" << std::endl;
+	}
+	else {
+		buildST();
+		buildSubPre();
+		buildBlock();
+	}
 
 }
 
@@ -188,17 +260,33 @@ int_t LinearSparseTable::queryMin(uint_t l, uint_t r) const {
 		int_t ans1 = I_MAX; // Initialize answer for block query
 		if (br - bl > 1) { // Query for blocks between l and r
 			int_t p = log[br - bl - 1];
-			ans1 = getMinValue(st[bl + 1][p], st[br - pow[p]][p]);
+			const uint_t* level = st.data() + p * row_stride;
+			ans1 = getMinValue(level[bl + 1], level[br - pow[p]]);
 		}
 		int_t ans2 = getMinValue(sub[l], pre[r]); // Query for prefix and suffix within blocks
 		return getMinValue(ans1, ans2); // Return the overall minimum
 	}
 	else { // If l and r are in the same block
-		return LCP[l + CTZ(f[r] >> pos[l]) - 1]; // Directly query within the block
+		return (*LCP)[l + CTZ(f[r] >> pos[l]) - 1]; // Directly query within the block
 	}
 }
 
 
+size_t LinearSparseTable::memoryBytes() const {
+	return st.size() * sizeof(uint_t) + (pow.size() + log.size() + pre.size() + sub.size() + belong.size() + pos.size()) * sizeof(uint_t)
+		+ f.size() * sizeof(uint64_t);
+}
+
+// Follows the sizes chosen by the constructor
+size_t LinearSparseTable::estimateBytes(uint_t n) {
+	size_t block_size = getMaxValue(getMinValue((int)(log2(n) * 1.5), 63), 1);
+	size_t block_num = (n + block_size - 1) / block_size;
+	size_t level_num = 1;
+	while (((size_t)1 << level_num) <= block_num) ++level_num;
+	size_t row_stride = (block_num + 1 + ST_ROW_ALIGN - 1) / ST_ROW_ALIGN * ST_ROW_ALIGN;
+	return level_num * row_stride * sizeof(uint_t) + (MAXM + 5 * ((size_t)n + 1)) * sizeof(uint_t) + ((size_t)n + 1) * sizeof(uint64_t);
+}
+
 // Returns the block ID to which the i-th element belongs
 int_t LinearSparseTable::getBelong(int_t i) const {
 	return (i - 1) / block_size + 1;
@@ -218,18 +306,20 @@ void LinearSparseTable::serialize(std::ostream& out) const {
 	saveNumber(out, N);
 	saveNumber(out, block_size);
 	saveNumber(out, block_num);
-
-	// Save precomputed vectors for LinearSparseTable algorithm
-	saveVector(out, pow);
-	saveVector(out, log);
-	saveVector(out, pre);
-	saveVector(out, sub);
-	saveVector(out, belong);
-	saveVector(out, pos);
-	saveVector(out, f);
-
-	// Save the 2D sparse table
-	saveVector2D(out, st);
+	saveNumber(out, level_num);
+	saveNumber(out, row_stride);
+
+	// Save precomputed vectors for LinearSparseTable algorithm, page-aligned so they can be mapped
+	saveAlignedArray(out, pow);
+	saveAlignedArray(out, log);
+	saveAlignedArray(out, pre);
+	saveAlignedArray(out, sub);
+	saveAlignedArray(out, belong);
+	saveAlignedArray(out, pos);
+	saveAlignedArray(out, f);
+
+	// Save the level-major sparse table in one block
+	saveAlignedArray(out, st);
 }
 
 
@@ -241,20 +331,36 @@ void LinearSparseTable::deserialize(std::istream& in) {
 	loadNumber(in, N);
 	loadNumber(in, block_size);
 	loadNumber(in, block_num);
+	loadNumber(in, level_num);
+	loadNumber(in, row_stride);
 
 	// Load precomputed vectors for LinearSparseTable algorithm
-	loadVector(in, pow);
-	loadVector(in, log);
-	loadVector(in, pre);
-	loadVector(in, sub);
-	loadVector(in, belong);
-	loadVector(in, pos);
-	loadVector(in, f);
-
-	// Load the 2D sparse table
-	loadVector2D(in, st);
+	loadAlignedArray(in, pow);
+	loadAlignedArray(in, log);
+	loadAlignedArray(in, pre);
+	loadAlignedArray(in, sub);
+	loadAlignedArray(in, belong);
+	loadAlignedArray(in, pos);
+	loadAlignedArray(in, f);
+
+	// Load the level-major sparse table in one block
+	loadAlignedArray(in, st);
+}
+
+// Attaches the vectors written by serialize without copying them.
+// The LCP array has to be set with setLCP before the first query.
+bool LinearSparseTable::map(MappedReader& in) {
+	if (!in.readNumber(N) || !in.readNumber(block_size) || !in.readNumber(block_num) || !in.readNumber(level_num) || !in.readNumber(row_stride))
+		return false;
+	if (!in.readArray(pow) || !in.readArray(log) || !in.readArray(pre) || !in.readArray(sub)
+		|| !in.readArray(belong) || !in.readArray(pos) || !in.readArray(f) || !in.readArray(st))
+		return false;
+	// Reject tables that do not match the header instead of reading out of bounds in queryMin
+	return pow.size() == MAXM && log.size() == N + 1 && pre.size() == N + 1 && sub.size() == N + 1
+		&& belong.size() == N + 1 && pos.size() == N + 1 && f.size() == N + 1
+		&& row_stride > block_num && st.size() == level_num * row_stride;
 }
 
-void LinearSparseTable::setLCP(int_t* A) {
+void LinearSparseTable::setLCP(const CompressedLCP* A) {
 	this->LCP = A;
 }
@@ -24,10 +24,20 @@
 #include "gsacak.h"
 #include "rare_match.h"
 #include "threadpool.h"
+#include "compressed_lcp.h"
 #include <algorithm>
+#include <string>
 
 #define MAXM 32
 
+// Number of LCP entries scanned in about the time of one query of LinearSparseTable. A query reads
+// about as few cache lines as a short scan, and neither scanning nor prefetching measurably beat it,
+// so the sparse table answers every range by query.
+#define LST_SCAN_ENTRIES 0
+
+// Number of sparse table entries per cache line; every level of a sparse table starts on a cache line.
+#define ST_ROW_ALIGN (CACHE_LINE_SIZE / sizeof(uint_t))
+
 // An inline function to count trailing zeros (CTZ) in a 64-bit unsigned integer.
 // The CTZ operation counts the number of zero bits starting from the least significant bit until the first one bit is found.
 inline uint_t CTZ(uint64_t x) {
@@ -96,26 +106,75 @@ inline uint_t CTZ(uint64_t x) {
 //}
 
 
-class LinearSparseTable : public Serializable {
+// Range minimum query structures over the LCP array that AnchorFinder can use.
+enum class RMQType {
+	SPARSE_TABLE, // LinearSparseTable, constant-time queries with several words per LCP entry
+	SUCCINCT,     // SuccinctRMQ, about 3 bits per LCP entry with slower queries
+};
+
+// Parses the name given on the command line ("sparse" or "succinct").
+// Returns false if the name is unknown.
+bool parseRMQType(const std::string& name, RMQType& type);
+
+// Returns the printable name of a range minimum query structure.
+std::string RMQTypeName(RMQType type);
+
+// Common interface of the range minimum query structures over the compressed LCP array.
+// The structures only keep what they need to answer queries; the values themselves are
+// read from the LCP array, which has to be set with setLCP after deserialize or map.
+class RangeMinQuery : public Serializable {
+public:
+	virtual ~RangeMinQuery() = default;
+
+	// Sets the LCP array the structure was built for
+	virtual void setLCP(const CompressedLCP* A) = 0;
+
+	// Queries the minimum value in the range [l, r]
+	virtual int_t queryMin(uint_t l, uint_t r) const = 0;
+
+	// Returns the number of bytes held by the structure, without the LCP array
+	virtual size_t memoryBytes() const = 0;
+
+	// Hints that queryMin(l, r) follows soon, so the first cache lines it reads can be loaded early.
+	// Only called on backends with scanEntries() > 0.
+	virtual void prefetch(uint_t /*l*/, uint_t /*r*/) const {}
+
+	// Number of LCP entries a linear scan reads in about the time of one query. Callers computing
+	// the minima of many neighbouring ranges scan the LCP array when the ranges are shorter.
+	// 0 means that plain queries are fastest, without scans or prefetching.
+	virtual uint_t scanEntries() const = 0;
+
+	// Uses the structure written by serialize in place from a mapped index file
+	virtual bool map(MappedReader& in) = 0;
+};
+
+// Thread pool and work statistics of a parallel LinearSparseTable construction
+struct ParallelBuild;
+
+class LinearSparseTable : public RangeMinQuery {
 private:
 	uint_t N, block_size, block_num;
-	int_t* LCP;
-	std::vector<std::vector<uint_t>> st; // Sparse table
-	std::vector<uint_t> pow, log; // Power and logarithm tables for fast computations
-	std::vector<uint_t> pre, sub; // Precomputed values for block and sub-block queries
-	std::vector<uint_t> belong, pos; // Auxiliary vectors for block decomposition
-	std::vector<uint64_t> f; // Auxiliary vector for queries
+	uint_t level_num; // Number of levels of the sparse table
+	size_t row_stride; // Distance between two levels of the sparse table, a multiple of ST_ROW_ALIGN
+	const CompressedLCP* LCP; // LCP values, read through the compressed accessor
+	// Sparse table in level-major order, level i of block j is stored at st[i * row_stride + j]
+	MappedArray<uint_t, CacheAlignedAllocator<uint_t>> st;
+	MappedArray<uint_t> pow, log; // Power and logarithm tables for fast computations
+	MappedArray<uint_t> pre, sub; // Precomputed values for block and sub-block queries
+	MappedArray<uint_t> belong, pos; // Auxiliary vectors for block decomposition
+	MappedArray<uint64_t> f; // Auxiliary vector for queries
 
 	// Builds the sparse table for RMQ
 	void buildST();
+	void buildSTParallel(ParallelBuild& build); // Parallel version
 
 	// Builds the precomputed tables for block and sub-block queries
 	void buildSubPre();
-	void buildSubPreParallel(uint_t thread_num); // Parallel version
+	void buildSubPreParallel(ParallelBuild& build); // Parallel version
 
 	// Builds blocks for the RMQ structure
 	void buildBlock();
-	void buildBlockParallel(uint_t thread_num); // Parallel version
+	void buildBlockParallel(ParallelBuild& build); // Parallel version
 
 	// Utility functions for block decomposition
 	int_t getBelong(int_t i) const;
@@ -123,28 +182,39 @@ private:
 
 public:
 	// Default constructor initializes members
-	explicit LinearSparseTable() : N(0), block_size(0), block_num(0), LCP(nullptr) {}
+	explicit LinearSparseTable() : N(0), block_size(0), block_num(0), level_num(0), row_stride(0), LCP(nullptr) {}
 
 	// Constructor initializes LCP array and builds RMQ structure
-	explicit LinearSparseTable(int_t* A, uint_t n, uint_t thread_num = 0);
+	explicit LinearSparseTable(const CompressedLCP* A, uint_t n, uint_t thread_num = 0);
 
-	void setLCP(int_t* A);
+	void setLCP(const CompressedLCP* A) override;
 
 	// Queries the minimum value in the range [l, r]
-	int_t queryMin(uint_t l, uint_t r) const;
+	int_t queryMin(uint_t l, uint_t r) const override;
+
+	uint_t scanEntries() const override { return LST_SCAN_ENTRIES; }
+
+	// Returns the number of bytes held by the tables
+	size_t memoryBytes() const override;
+
+	// Returns the number of bytes the tables of n LCP entries will hold, before building them
+	static size_t estimateBytes(uint_t n);
 
 	// Serializes the RMQ structure to an output stream
 	void serialize(std::ostream& out) const override;
 
 	// Deserializes the RMQ structure from an input stream
 	void deserialize(std::istream& in) override;
+
+	// Uses the RMQ structure written by serialize in place from a mapped index file
+	bool map(MappedReader& in) override;
 };
 
 
 class SparseTable : public Serializable {
 public:
 	// Default constructor initializes members
-	explicit SparseTable() : N(0) {}
+	explicit SparseTable() : LCP(nullptr), N(0), row_stride(0) {}
 
 	SparseTable(const int_t* LCP, size_t N) : LCP(LCP), N(N) {
 		build(LCP);
@@ -153,21 +223,24 @@ public:
 	int_t queryMin(size_t L, size_t R) const {
 		if (L > R) std::swap(L, R);
 		int_t j = log2[R - L + 1];
-		return std::min(st[L][j], st[R - (1 << j) + 1][j]);
+		const int_t* level = st.data() + j * row_stride;
+		return std::min(level[L], level[R - ((size_t)1 << j) + 1]);
 	}
 
 	// Serializes the RMQ structure to an output stream
 	void serialize(std::ostream& out) const override {
 		saveNumber(out, N);
-		saveVector2D(out, st);
-		saveVector(out, log2);
+		saveNumber(out, row_stride);
+		saveAlignedArray(out, st);
+		saveAlignedArray(out, log2);
 	}
 
 	// Deserializes the RMQ structure from an input stream
 	void deserialize(std::istream& in) override {
 		loadNumber(in, N);
-		loadVector2D(in, st);
-		loadVector(in, log2);
+		loadNumber(in, row_stride);
+		loadAlignedArray(in, st);
+		loadAlignedArray(in, log2);
 	}
 
 	void setLCP(int_t* A) {
@@ -177,25 +250,29 @@ public:
 private:
 	const int_t* LCP;
 	size_t N;
-	std::vector<std::vector<int_t>> st;
-	std::vector<int_t> log2;
+	size_t row_stride; // Distance between two levels, a multiple of a cache line
+	// Level-major table, the minimum of LCP[i .. i + 2^j) is stored at st[j * row_stride + i]
+	MappedArray<int_t, CacheAlignedAllocator<int_t>> st;
+	MappedArray<int_t> log2;
 
 	void build(const int_t* LCP) {
 		size_t K = std::log2(N) + 1;
-		st.assign(N, std::vector<int_t>(K, I_MAX));
+		size_t align = CACHE_LINE_SIZE / sizeof(int_t);
+		row_stride = (N + align - 1) / align * align;
+		st.assign(K * row_stride, I_MAX);
 		log2.assign(N + 1, 0);
 
 		for (size_t i = 2; i <= N; i++) {
 			log2[i] = log2[i / 2] + 1;
 		}
 
-		for (size_t i = 0; i < N; i++) {
-			st[i][0] = LCP[i];
-		}
+		std::copy(LCP, LCP + N, &st[0]);
 
-		for (size_t j = 1; j <= K; j++) {
-			for (size_t i = 0; i + (1 << j) <= N; i++) {
-				st[i][j] = std::min(st[i][j - 1], st[i + (1 << (j - 1))][j - 1]);
+		for (size_t j = 1; j < K; j++) {
+			int_t* level = &st[j * row_stride];
+			const int_t* prev = &st[(j - 1) * row_stride];
+			for (size_t i = 0; i + ((size_t)1 << j) <= N; i++) {
+				level[i] = std::min(prev[i], prev[i + ((size_t)1 << (j - 1))]);
 			}
 		}
 	}
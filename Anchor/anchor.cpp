@@ -56,60 +56,199 @@ void saveIntervalsToCSV(const Intervals& intervals, const std::string& filename)
 	logger.info() << filename << " has been saved" << std::endl;
 }
 
+// Intervals of n bases in both sequences are cut off while wavefront_cell_ns * n^2 - 2 * anchor_base_ns * n
+// + wavefront_task_ns - anchor_task_ns is negative, i.e. below the larger root of this quadratic.
+uint_t RecursionCostModel::balancedThreshold() const {
+	if (!enabled || wavefront_cell_ns <= 0) return 0;
+	double discriminant = anchor_base_ns * anchor_base_ns - wavefront_cell_ns * (wavefront_task_ns - anchor_task_ns);
+	if (discriminant < 0) return 0;
+	double root = (anchor_base_ns + std::sqrt(discriminant)) / wavefront_cell_ns;
+	return root < 1 ? 0 : (uint_t)getMinValue(std::ceil(root) - 1, (double)U_MAX);
+}
+
+// Sample j has the length of size j % COST_SAMPLE_SIZES and starts at j / sample_num of both sequences.
+// Lengths that do not fit between the starts are left out, so the samples never overlap.
+Intervals RecursionCostModel::sampleIntervals(uint_t first_len, uint_t second_len) {
+	Intervals samples;
+	uint_t sample_num = COST_SAMPLE_SIZES * COST_SAMPLES_PER_SIZE;
+	uint_t slot = getMinValue(first_len, second_len) / sample_num;
+	for (uint_t j = 0; j < sample_num; ++j) {
+		uint_t length = COST_SAMPLE_MIN_LENGTH << (j % COST_SAMPLE_SIZES);
+		if (length > slot) continue;
+		samples.emplace_back((uint_t)((uint64_t)first_len * j / sample_num), length, (uint_t)((uint64_t)second_len * j / sample_num), length);
+	}
+	return samples;
+}
+
+// The relative errors are minimized, i.e. time / x = b + a / x is fitted, so the short samples that
+// decide the cutoff weigh as much as the long ones. A negative a is dropped by fitting b alone, and
+// a b that is not positive by attributing the whole time to x.
+void RecursionCostModel::fitLine(const std::vector<double>& x, const std::vector<double>& time, double& a, double& b) {
+	a = b = 0;
+	double n = 0, sum_u = 0, sum_v = 0, sum_uu = 0, sum_uv = 0;
+	for (size_t i = 0; i < x.size(); ++i) {
+		if (x[i] <= 0) continue;
+		double u = 1 / x[i], v = time[i] / x[i];
+		++n;
+		sum_u += u;
+		sum_v += v;
+		sum_uu += u * u;
+		sum_uv += u * v;
+	}
+	if (!n) return;
+	double denominator = n * sum_uu - sum_u * sum_u;
+	if (denominator > 0) {
+		a = (n * sum_uv - sum_u * sum_v) / denominator;
+		b = (sum_v - a * sum_u) / n;
+	}
+	if (denominator <= 0 || a < 0) {
+		a = 0;
+		b = sum_v / n;
+	}
+	if (b <= 0) {
+		a = 0;
+		b = sum_v / n;
+	}
+}
+
+bool parseCostModel(const std::string& value, RecursionCostModel& model) {
+	if (value == "auto") {
+		model.enabled = model.calibrate = true;
+		return true;
+	}
+	double* costs[] = { &model.wavefront_task_ns, &model.wavefront_cell_ns, &model.anchor_task_ns, &model.anchor_base_ns };
+	size_t begin = 0;
+	for (size_t i = 0; i < 4; ++i) {
+		size_t end = value.find(',', begin);
+		if ((end == std::string::npos) != (i == 3)) return false;
+		std::string field = value.substr(begin, end == std::string::npos ? std::string::npos : end - begin);
+		size_t parsed = 0;
+		try {
+			*costs[i] = std::stod(field, &parsed);
+		}
+		catch (std::exception&) {
+			return false;
+		}
+		if (parsed != field.size() || *costs[i] < 0) return false;
+		begin = end + 1;
+	}
+	model.enabled = model.wavefront_cell_ns > 0;
+	model.calibrate = false;
+	return model.enabled;
+}
+
 // Constructor for AnchorFinder class
-AnchorFinder::AnchorFinder(std::vector<SequenceInfo>& data, std::string save_file_path, uint_t thread_num, bool load_from_disk, bool save_to_disk, uint_t max_match_count) :
+AnchorFinder::AnchorFinder(std::vector<SequenceInfo>& data, std::string save_file_path, const AnchorFinderOptions& options) :
+	thread_num(options.thread_num),
 	save_file_path(save_file_path),
-	thread_num(thread_num),
-	max_match_count(max_match_count) {
+	max_match_count(options.max_match_count),
+	max_pairs_per_match(options.max_pairs_per_match),
+	kmer_interval_size(options.kmer_interval_size),
+	repeat_anchors(options.repeat_anchors),
+	adaptive_match_count(options.adaptive_match_count),
+	cost_model(options.cost_model),
+	sa_algorithm(resolveSAAlgorithm(options.sa_algorithm, options.thread_num)),
+	memory_budget(options.memory_budget),
+	filter_children(options.filter_children),
+	tmp_dir(options.tmp_dir),
+	index_cache_dir(options.index_cache_dir),
+	ref_index_path(options.ref_index_path),
+	ref_index_key(options.ref_index_path.empty() ? 0 : ReferenceIndex::computeKey(data[0].sequence)),
+	index_key(computeIndexKey(data, options.rmq_type)),
+	SA(nullptr),
+	LCP(nullptr),
+	ISA(nullptr),
+	rmq_type(options.rmq_type),
+	total_scan_segments(0),
+	total_scanned_entries(0),
+	total_rmq_segments(0),
+	total_rmq_queries(0),
+	total_pruned_pairs(0),
+	total_array_tasks(0),
+	total_array_nanoseconds(0),
+	total_kmer_tasks(0),
+	total_kmer_nanoseconds(0),
+	total_repeat_tasks(0),
+	total_repeat_pairs(0),
+	total_rare_tasks(0),
+	total_match_count(0),
+	total_raised_tasks(0),
+	total_retried_tasks(0),
+	total_anchorless_tasks(0),
+	total_anchorless_bases(0),
+	total_cutoff_tasks(0),
+	total_cutoff_bases(0) {
+	bool load_from_disk = options.load_from_disk;
+	bool save_to_disk = options.save_to_disk;
 	first_seq_len = data[0].seq_len;
 	second_seq_len = data[1].seq_len;
 	concatSequence(data); // Concatenate sequences from input data
 	logger.info() << "The concated data length is " << concat_data_length << std::endl;
 
-	// Allocate memory for Suffix Array (SA), Longest Common Prefix (LCP), and Document Array (DA)
-	this->SA = (uint_t*)malloc(concat_data_length * sizeof(uint_t));
-	if (!SA) {
-		logger.error() << "Failed to allocate " << concat_data_length * sizeof(uint_t) << "bytes of SA." << std::endl;
-		logger.error() << "RaMA Exit!" << std::endl;
-		exit(EXIT_FAILURE);
-	}
-
-	this->LCP = (int_t*)malloc(concat_data_length * sizeof(int_t));
-	if (!LCP) {
-		logger.error() << "Failed to allocate " << concat_data_length * sizeof(int_t) << "bytes of LCP." << std::endl;
-		logger.error() << "RaMA Exit!" << std::endl;
-		exit(EXIT_FAILURE);
+	// The RMQ structure always stays in RAM. Under a memory budget, the sparse table gives way to the
+	// succinct RMQ if it does not fit beside the arrays, so the index key has to follow the choice.
+	size_t array_bytes = (size_t)concat_data_length * (2 * sizeof(uint_t) + sizeof(int_t) + 1);
+	if (memory_budget > 0 && rmq_type == RMQType::SPARSE_TABLE
+		&& array_bytes + estimateRMQBytes(rmq_type, concat_data_length) > memory_budget) {
+		logger.info() << "The " << RMQTypeName(rmq_type) << " RMQ structure needs " << estimateRMQBytes(rmq_type, concat_data_length)
+			<< " bytes and does not fit into the memory budget of " << memory_budget << " bytes, the "
+			<< RMQTypeName(RMQType::SUCCINCT) << " one is used instead" << std::endl;
+		rmq_type = RMQType::SUCCINCT;
+		index_key = computeIndexKey(data, rmq_type);
 	}
-
-	this->DA = (int_da*)malloc(concat_data_length * sizeof(int_da));
-	if (!DA) {
-		logger.error() << "Failed to allocate " << concat_data_length * sizeof(int_t) << "bytes of DA." << std::endl;
-		logger.error() << "RaMA Exit!" << std::endl;
-		exit(EXIT_FAILURE);
-	}
-
-	this->ISA = (uint_t*)malloc(concat_data_length * sizeof(uint_t));
-	if (!ISA) {
-		logger.error() << "Failed to allocate " << concat_data_length * sizeof(uint_t) << "bytes of ISA." << std::endl;
-		logger.error() << "RaMA Exit!" << std::endl;
-		exit(EXIT_FAILURE);
+	size_t rmq_bytes = estimateRMQBytes(rmq_type, concat_data_length);
+	if (memory_budget > 0 && rmq_bytes > memory_budget) {
+		logger.info() << "The " << RMQTypeName(rmq_type) << " RMQ structure alone needs " << rmq_bytes
+			<< " bytes, more than the memory budget of " << memory_budget << " bytes" << std::endl;
 	}
 
 	std::string bin_file_dir = joinPaths(save_file_path, SAVE_DIR);
 	ensureDirExists(bin_file_dir);
 	std::string save_file_name = joinPaths(bin_file_dir, ANCHORFINDER_NAME);
 
-	// Load arrays from disk if specified, otherwise construct the suffix array
-	if (load_from_disk && fileExists(save_file_name) && loadFromFile(save_file_name)) {
-		logger.info() << "AnchorFinder is loaded from " + save_file_name << std::endl;
+	// With a shared cache the index is looked up by its key and stored there after construction
+	if (!index_cache_dir.empty()) {
+		std::stringstream key;
+		key << std::hex << std::setw(16) << std::setfill('0') << index_key;
+		ensureDirExists(index_cache_dir);
+		save_file_name = joinPaths(index_cache_dir, ANCHORFINDER_CACHE_PREFIX + key.str() + ".bin");
+		logger.info() << "The index key is " << key.str() << ", the index cache is " << index_cache_dir << std::endl;
+		load_from_disk = true;
+		save_to_disk = true;
+	}
+
+	// Build the arrays on the scratch disk if keeping them in RAM beside the RMQ structure would exceed the memory budget
+	size_t in_memory_bytes = array_bytes + rmq_bytes;
+	semi_external = memory_budget > 0 && in_memory_bytes > memory_budget;
+	if (semi_external) {
+		if (this->tmp_dir.empty()) this->tmp_dir = bin_file_dir;
+		ensureDirExists(this->tmp_dir);
+		logger.info() << "The arrays and the RMQ structure need " << in_memory_bytes << " bytes, more than the memory budget of " << memory_budget
+			<< " bytes. They are built semi-externally in " << this->tmp_dir << std::endl;
+		if (!ref_index_path.empty()) {
+			logger.info() << "The reference index " << ref_index_path << " is ignored under the memory budget, it is neither used nor built" << std::endl;
+		}
+	}
+
+	// Map the arrays from disk if specified, otherwise construct the suffix array
+	if (load_from_disk && fileExists(save_file_name) && mapFromFile(save_file_name)) {
+		logger.info() << "AnchorFinder is mapped from " + save_file_name << std::endl;
+		if (logger.isDebugEnabled()) {
+			printDebugInfo(SA, compressed_LCP, concat_data_length);
+		}
 	}
 	else {
 		if (load_from_disk) {
 			logger.info() << "Fail to load " << save_file_name << ", start to construct arrays!" << std::endl;
 		}
-		logger.info() << "The suffix array is constructing..." << std::endl;
+		// Allocate memory for Suffix Array (SA) and Inverse Suffix Array (ISA); LCP is allocated only for construction.
+		// When child intervals are filtered, ISA is only built to be saved with the index.
+		this->SA = allocateArray<uint_t>("SA", sa_file);
+		if (!filter_children || save_to_disk) this->ISA = allocateArray<uint_t>("ISA", isa_file);
+		this->LCP = allocateArray<int_t>("LCP", lcp_file);
+		logger.info() << "The suffix array is constructing with " << (semi_external ? "semi-external prefix doubling" : SAAlgorithmName(this->sa_algorithm)) << "..." << std::endl;
 		try {
-			gsacak(concat_data, SA, LCP, DA, concat_data_length);
+			constructSuffixArray();
 			logger.info() << "The suffix array construction is finished!" << std::endl;
 		}
 		catch (std::exception& e) {
@@ -118,10 +257,15 @@ AnchorFinder::AnchorFinder(std::vector<SequenceInfo>& data, std::string save_fil
 			exit(EXIT_FAILURE);
 		}
 
-		logger.info() << "The sparse table is constructing..." << std::endl;
+		compressLCP();
+
+		logger.info() << "The " << RMQTypeName(rmq_type) << " RMQ structure is constructing..." << std::endl;
 		try {
-			this->rmq = LinearSparseTable(LCP, concat_data_length, thread_num);
-			logger.info() << "The sparse table construction is finished!" << std::endl;
+			if (rmq_type == RMQType::SUCCINCT)
+				this->rmq.reset(new SuccinctRMQ(&compressed_LCP, concat_data_length));
+			else
+				this->rmq.reset(new LinearSparseTable(&compressed_LCP, concat_data_length, thread_num));
+			logger.info() << "The RMQ structure construction is finished, it takes " << rmq->memoryBytes() << " bytes" << std::endl;
 		}
 		catch (std::exception& e) {
 			logger.error() << "Error: " << e.what() << std::endl;
@@ -130,33 +274,130 @@ AnchorFinder::AnchorFinder(std::vector<SequenceInfo>& data, std::string save_fil
 		}
 
 
-		if (thread_num)
+		packConcatSequence();
+
+		if (!ISA)
+			logger.info() << "ISA is not constructed, the sub suffix arrays are filtered from their parents" << std::endl;
+		else if (semi_external)
+			semiExternalISA(SA, ISA, concat_data_length, externalBlockLength(), scratchPrefix());
+		else if (thread_num)
 			constructISAParallel(thread_num);
 		else
 			constructISA(0, concat_data_length - 1);
 
+		if (logger.isDebugEnabled()) {
+			printDebugInfo(SA, compressed_LCP, concat_data_length);
+		}
+
 		if (save_to_disk) {
-			if (saveToFile(save_file_name))
-				logger.info() << "AnchorFinder is saved into " + save_file_name << std::endl;
-			else
-				logger.info() << "Fail to save " + save_file_name << std::endl;
+			saveInBackground(save_file_name);
 		}
 
 	}
 
-	if (logger.isDebugEnabled()) {
-		printDebugInfo(SA, LCP, DA, concat_data_length);
+	// The byte text is only needed by the suffix array construction.
+	if (concat_data) {
+		delete[] concat_data;
+		concat_data = nullptr;
 	}
+
+	// The anchor search gathers SA and ISA entries at random positions. With filter_children the
+	// search does not read ISA, and the background save releases it, so isa_file belongs to that
+	// thread once the save is started.
+	sa_file.adviseRandom();
+	if (!filter_children) isa_file.adviseRandom();
+	index_file.adviseRandom();
 }
 
 // Destructor for AnchorFinder class
 AnchorFinder::~AnchorFinder() {
+	// The background save still reads the arrays
+	waitForSave();
 	// Free allocated memory
 	if (concat_data) delete[] concat_data;
-	if (SA) free(SA);
-	if (LCP) free(LCP);
-	if (DA) free(DA);
-	if (ISA) free(ISA);
+	// Arrays in scratch files are unmapped and deleted by their MappedFile,
+	// arrays of a mapped index belong to index_file
+	if (SA && !sa_file.isOpen() && !index_file.isOpen()) free(SA);
+	if (LCP && !lcp_file.isOpen()) free(LCP);
+	if (ISA && !isa_file.isOpen() && !index_file.isOpen()) free(ISA);
+}
+
+// The index is written by a single writer thread; the arrays are only read after construction.
+void AnchorFinder::saveInBackground(const std::string& file_name) {
+	logger.info() << "AnchorFinder is saving into " << file_name << " in the background" << std::endl;
+	save_thread = std::thread([this, file_name]() {
+		auto start = std::chrono::steady_clock::now();
+		if (saveToFileAtomically(file_name)) {
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			double megabytes = std::filesystem::file_size(file_name) / (1024.0 * 1024.0);
+			logger.info() << "AnchorFinder is saved into " << file_name << ": " << megabytes << " MB in " << seconds
+				<< " s (" << megabytes / getMaxValue(seconds, 1e-6) << " MB/s)" << std::endl;
+		}
+		else {
+			logger.info() << "Fail to save " + file_name << std::endl;
+		}
+		// The search does not read ISA when child intervals are filtered
+		if (filter_children) releaseISA();
+		});
+}
+
+void AnchorFinder::releaseISA() {
+	// ISA of a mapped index stays in the page cache and is never touched
+	if (!ISA || index_file.isOpen()) return;
+	if (isa_file.isOpen())
+		isa_file.close();
+	else
+		free(ISA);
+	ISA = nullptr;
+	logger.info() << "ISA is released" << std::endl;
+}
+
+void AnchorFinder::waitForSave() {
+	if (save_thread.joinable()) save_thread.join();
+}
+
+// Compresses the LCP array to one byte per entry and releases the full array.
+void AnchorFinder::compressLCP() {
+	compressed_LCP = CompressedLCP(LCP, concat_data_length);
+	if (lcp_file.isOpen())
+		lcp_file.close();
+	else
+		free(LCP);
+	LCP = nullptr;
+	logger.info() << "The LCP array is compressed into " << compressed_LCP.memoryBytes() << " bytes, "
+		<< compressed_LCP.overflowSize() << " values are kept in the overflow table" << std::endl;
+}
+
+// Allocates an array of concat_data_length elements. In semi-external mode the array is a
+// memory-mapped scratch file named after the process, otherwise it is allocated with malloc.
+template<typename T>
+T* AnchorFinder::allocateArray(const std::string& name, MappedFile& file) {
+	size_t bytes = (size_t)concat_data_length * sizeof(T);
+	T* array = nullptr;
+	if (semi_external) {
+		std::string file_name = scratchPrefix() + name + ".bin";
+		if (file.create(file_name, bytes)) array = static_cast<T*>(file.data());
+	}
+	else {
+		array = (T*)malloc(bytes);
+	}
+	if (!array) {
+		logger.error() << "Failed to allocate " << bytes << "bytes of " << name << "." << std::endl;
+		logger.error() << "RaMA Exit!" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	return array;
+}
+
+std::string AnchorFinder::scratchPrefix() const {
+	return joinPaths(tmp_dir, "RaMA_" + std::to_string(getpid()) + "_");
+}
+
+// Half of the memory budget is used for the blocks, the rest is left for the text and the page cache.
+// A block holds at most three entries per suffix, the names and the position of a sorted run.
+uint_t AnchorFinder::externalBlockLength() const {
+	size_t block_len = getMaxValue(memory_budget / 2 / (3 * sizeof(uint_t)), (size_t)1 << 20);
+	return (uint_t)getMinValue(block_len, (size_t)concat_data_length);
 }
 
 // Concatenates sequences and prepares data for suffix array construction
@@ -190,54 +431,157 @@ void AnchorFinder::concatSequence(std::vector<SequenceInfo>& data) {
 	concat_data_length = total_length;
 }
 
+// Converts the concatenated data into the packed text used by the anchor search.
+// DNA is stored with 2 bits per base, other alphabets fall back to one byte per character.
+void AnchorFinder::packConcatSequence() {
+	text = PackedText(concat_data, concat_data_length);
+	if (text.isPacked())
+		logger.info() << "The concated data is packed into " << text.memoryBytes() << " bytes with 2 bits per base" << std::endl;
+	else
+		logger.info() << "The concated data contains non-ACGT characters and is kept as bytes" << std::endl;
+}
+
 
 // Serializes the state of the AnchorFinder object to an output stream.
-// This includes all fundamental configurations, concatenated sequence data,
-// various arrays such as Suffix Array (SA), Longest Common Prefix (LCP), 
-// Document Array (DA), Inverse Suffix Array (ISA), and the associated RMQ structure.
+// The header (magic, format version, uint_t width, RMQ type and sequence lengths) is followed by the
+// packed text, the Suffix Array (SA), the compressed LCP, the Inverse Suffix Array (ISA) and
+// the RMQ structure. Every array starts on a page boundary, so the file can be mapped and used in place.
 void AnchorFinder::serialize(std::ostream& out) const {
-	// Save basic configuration numbers
+	// Save the header and basic configuration numbers
+	uint32_t version = ANCHORFINDER_VERSION, uint_width = sizeof(uint_t), rmq_code = (uint32_t)rmq_type;
+	saveArray(out, ANCHORFINDER_MAGIC, sizeof(ANCHORFINDER_MAGIC));
+	saveNumber(out, version);
+	saveNumber(out, uint_width);
+	saveNumber(out, rmq_code);
+	saveNumber(out, index_key);
 	saveNumber(out, concat_data_length);
 	saveNumber(out, first_seq_len);
 	saveNumber(out, second_seq_len);
 
 	// Save concatenated sequence data and associated arrays
-	saveArray(out, concat_data, concat_data_length);
-	saveArray(out, SA, concat_data_length);
-	saveArray(out, LCP, concat_data_length);
-	saveArray(out, DA, concat_data_length);
-	saveArray(out, ISA, concat_data_length);
+	text.serialize(out);
+	saveAlignedArray(out, SA, concat_data_length);
+	compressed_LCP.serialize(out);
+	saveAlignedArray(out, ISA, concat_data_length);
 
 	// Serialize the RMQ structure
-	this->rmq.serialize(out);
+	this->rmq->serialize(out);
 }
 
 
-// Deserializes the state of the AnchorFinder object from an input stream.
-// This method loads the AnchorFinder configuration, concatenated sequence data,
-// various arrays (SA, LCP, DA, ISA), and reconstructs the RMQ state for future queries.
+// Deserializes the state of the AnchorFinder object from an input stream into memory.
+// The regular loading path is mapFromFile, which uses the file in place.
 void AnchorFinder::deserialize(std::istream& in) {
-	// Load basic configuration numbers
+	// Skip the header and load basic configuration numbers
+	char magic[sizeof(ANCHORFINDER_MAGIC)];
+	uint32_t version, uint_width, rmq_code;
+	loadArray(in, magic, sizeof(magic));
+	loadNumber(in, version);
+	loadNumber(in, uint_width);
+	loadNumber(in, rmq_code);
+	loadNumber(in, index_key);
 	loadNumber(in, concat_data_length);
 	loadNumber(in, first_seq_len);
 	loadNumber(in, second_seq_len);
 
 	// Load concatenated sequence data and associated arrays
-	loadArray(in, concat_data, concat_data_length);
-	loadArray(in, SA, concat_data_length);
-	loadArray(in, LCP, concat_data_length);
-	loadArray(in, DA, concat_data_length);
-	loadArray(in, ISA, concat_data_length);
+	text.deserialize(in);
+	if (!SA) SA = allocateArray<uint_t>("SA", sa_file);
+	loadAlignedArray(in, SA, concat_data_length);
+	compressed_LCP.deserialize(in);
+	if (!ISA) ISA = allocateArray<uint_t>("ISA", isa_file);
+	loadAlignedArray(in, ISA, concat_data_length);
 
 	// Deserialize the RMQ structure and set the LCP array for RMQ queries
-	this->rmq.deserialize(in);
-	this->rmq.setLCP(LCP);
+	rmq_type = (RMQType)rmq_code;
+	this->rmq = createRMQ();
+	this->rmq->deserialize(in);
+	this->rmq->setLCP(&compressed_LCP);
+}
+
+
+// The key covers the content of both sequences in order, the RMQ type, the uint_t width and the
+// format version, so an index is only reused for exactly the same text and structures.
+uint64_t AnchorFinder::computeIndexKey(const std::vector<SequenceInfo>& data, RMQType rmq_type) {
+	uint64_t key = mixHash(((uint64_t)ANCHORFINDER_VERSION << 16) | ((uint64_t)rmq_type << 8) | sizeof(uint_t));
+	for (const auto& s : data) {
+		key = hashString(s.sequence, key);
+	}
+	return key;
+}
+
+std::unique_ptr<RangeMinQuery> AnchorFinder::createRMQ() const {
+	if (rmq_type == RMQType::SUCCINCT) return std::unique_ptr<RangeMinQuery>(new SuccinctRMQ());
+	return std::unique_ptr<RangeMinQuery>(new LinearSparseTable());
+}
+
+size_t AnchorFinder::estimateRMQBytes(RMQType rmq_type, uint_t n) {
+	if (rmq_type == RMQType::SUCCINCT) return SuccinctRMQ::estimateBytes(n);
+	return LinearSparseTable::estimateBytes(n);
+}
+
+// Maps anchorfinder.bin read-only and attaches all arrays to the mapping. Pages are only read
+// when the anchor search touches them, and processes mapping the same file share the pages.
+bool AnchorFinder::mapFromFile(const std::string& file_name) {
+	if (!index_file.open(file_name)) return false;
+	MappedReader in(index_file.data(), index_file.size());
+
+	// Check that the index was written by this format version for the current sequences
+	char magic[sizeof(ANCHORFINDER_MAGIC)];
+	uint32_t version = 0, uint_width = 0, rmq_code = 0;
+	uint64_t key = 0;
+	uint_t length = 0, first_len = 0, second_len = 0;
+	for (char& c : magic) in.readNumber(c);
+	in.readNumber(version);
+	in.readNumber(uint_width);
+	in.readNumber(rmq_code);
+	in.readNumber(key);
+	in.readNumber(length);
+	in.readNumber(first_len);
+	in.readNumber(second_len);
+	if (!in.ok() || memcmp(magic, ANCHORFINDER_MAGIC, sizeof(magic)) != 0 || version != ANCHORFINDER_VERSION) {
+		logger.info() << file_name << " is not an index of format version " << ANCHORFINDER_VERSION << std::endl;
+		index_file.close();
+		return false;
+	}
+	if (rmq_code != (uint32_t)rmq_type) {
+		logger.info() << file_name << " was built with another RMQ structure than " << RMQTypeName(rmq_type) << std::endl;
+		index_file.close();
+		return false;
+	}
+	if (uint_width != sizeof(uint_t) || key != index_key
+		|| length != concat_data_length || first_len != first_seq_len || second_len != second_seq_len) {
+		logger.info() << file_name << " was built for other sequences or another uint_t width" << std::endl;
+		index_file.close();
+		return false;
+	}
+	rmq = createRMQ();
+
+	// Attach the arrays; SA and ISA are never written after construction
+	const uint_t* sa = nullptr;
+	const uint_t* isa = nullptr;
+	uint64_t sa_size = 0, isa_size = 0;
+	bool mapped = text.map(in) && in.readArray(sa, sa_size) && compressed_LCP.map(in)
+		&& in.readArray(isa, isa_size) && rmq->map(in);
+	if (!mapped || text.size() != concat_data_length || sa_size != concat_data_length
+		|| compressed_LCP.size() != concat_data_length || isa_size != concat_data_length) {
+		logger.info() << file_name << " is truncated or corrupted" << std::endl;
+		text = PackedText();
+		compressed_LCP = CompressedLCP();
+		rmq.reset();
+		index_file.close();
+		return false;
+	}
+	SA = const_cast<uint_t*>(sa);
+	ISA = const_cast<uint_t*>(isa);
+	rmq->setLCP(&compressed_LCP);
+	return true;
 }
 
 
 // Prints the debug information for SA, LCP, DA, and ISA arrays.
 // This includes indexing and the values within each array for debugging purposes.
-void AnchorFinder::printDebugInfo(const uint_t* SA, const int_t* LCP, const int_da* DA, uint_t concat_data_length) {
+void AnchorFinder::printDebugInfo(const uint_t* SA, const CompressedLCP& LCP, uint_t concat_data_length) {
 	std::stringstream s;
 
 	// Print indices for reference
@@ -264,15 +608,16 @@ void AnchorFinder::printDebugInfo(const uint_t* SA, const int_t* LCP, const int_
 	logger.debug() << s.str() << std::endl;
 	s.str("");
 
-	// Print Document Array (DA) values
+	// Print Document Array (DA) values, derived from the suffix positions
 	s << "    DA: ";
 	for (uint_t i = 0; i < concat_data_length; ++i) {
-		s << std::setw(6) << std::left << DA[i] << " ";
+		s << std::setw(6) << std::left << documentOf(SA[i]) << " ";
 	}
 	logger.debug() << s.str() << std::endl;
 	s.str("");
 
 	// Print Inverse Suffix Array (ISA) values
+	if (!ISA) return;
 	s << "   ISA: ";
 	for (uint_t i = 0; i < concat_data_length; ++i) {
 		s << std::setw(6) << std::left << ISA[i] << " ";
@@ -281,6 +626,41 @@ void AnchorFinder::printDebugInfo(const uint_t* SA, const int_t* LCP, const int_
 	s.str("");
 }
 
+// Constructs SA and LCP of the concatenated data. DA is not built: with two documents
+// the origin of a suffix follows from its position, see documentOf.
+// The parallel engine produces exactly the same arrays as gsacak, so the rest of the
+// anchor search does not depend on which engine was chosen.
+void AnchorFinder::constructSuffixArray() {
+	if (semi_external) {
+		semiExternalSACA(concat_data, SA, LCP, concat_data_length, externalBlockLength(), scratchPrefix());
+	}
+	else if (!ref_index_path.empty()) {
+		constructFromReferenceIndex();
+	}
+	else {
+		buildSuffixArray(concat_data, SA, LCP, concat_data_length, sa_algorithm, thread_num);
+	}
+}
+
+// The reference index only depends on the first sequence, so it is shared by all queries aligned
+// against the same reference. Only the query suffixes are sorted for each run.
+void AnchorFinder::constructFromReferenceIndex() {
+	ReferenceIndex ref_index;
+	if (fileExists(ref_index_path) && ref_index.mapFromFile(ref_index_path, ref_index_key, first_seq_len)) {
+		logger.info() << "The reference index is mapped from " << ref_index_path << std::endl;
+	}
+	else {
+		logger.info() << "The reference index is constructing..." << std::endl;
+		ref_index.build(concat_data, first_seq_len, ref_index_key, sa_algorithm, thread_num);
+		if (ref_index.saveToFileAtomically(ref_index_path))
+			logger.info() << "The reference index is saved into " << ref_index_path << std::endl;
+		else
+			logger.info() << "Fail to save the reference index into " << ref_index_path << std::endl;
+	}
+	logger.info() << "The query suffixes are merging into the reference index..." << std::endl;
+	ref_index.mergeQuery(concat_data, concat_data_length, SA, LCP, sa_algorithm, thread_num);
+}
+
 // Constructs the Inverse Suffix Array (ISA) for the given range.
 // ISA array is built by marking the index of each element of SA in the ISA array,
 // which is useful for various string processing algorithms.
@@ -316,19 +696,33 @@ void AnchorFinder::constructISAParallel(uint_t thread_num) {
 RareMatchPairs AnchorFinder::lanuchAnchorSearching() {
 	logger.info() << "Begin to search anchors" << std::endl;
 	total_sub_suffix_array = 0;
+	total_scan_segments = total_scanned_entries = total_rmq_segments = total_rmq_queries = 0;
+	total_pruned_pairs = 0;
+	total_array_tasks = total_array_nanoseconds = total_kmer_tasks = total_kmer_nanoseconds = 0;
+	total_repeat_tasks = total_repeat_pairs = 0;
+	total_rare_tasks = total_match_count = total_raised_tasks = total_retried_tasks = total_anchorless_tasks = total_anchorless_bases = 0;
+	total_cutoff_tasks = total_cutoff_bases = 0;
 	ThreadPool pool(thread_num); // Use thread pool for potential parallel execution
 	uint_t depth = 0;
 	Anchor* root = new Anchor(depth); // Create root anchor node
 	Interval interval(0, first_seq_len, 0, second_seq_len); // Define interval
 	uint_t task_id = 0;
+	SubSuffixArray sub = filter_children && !isKmerInterval(interval) ? rootSubArrays() : SubSuffixArray();
+	if (cost_model.calibrate) measureAnchorCost(sub);
+	if (cost_model.enabled) {
+		logger.info() << "Intervals are aligned as a whole once wavefront alignment is predicted to take less than their anchor search: "
+			<< cost_model.wavefront_task_ns << " + " << cost_model.wavefront_cell_ns << " * n * m ns against " << cost_model.anchor_task_ns
+			<< " + " << cost_model.anchor_base_ns << " * (n + m) ns, which cuts off intervals of up to " << cost_model.balancedThreshold()
+			<< " bases in both sequences" << std::endl;
+	}
 	if (thread_num) {
-		pool.enqueue([this, &pool, depth, task_id, root, interval]() {
-			this->locateAnchor(pool, depth, task_id, root, interval);
+		pool.enqueue([this, &pool, depth, task_id, root, interval, sub = std::move(sub)]() mutable {
+			this->locateAnchor(pool, depth, task_id, root, interval, std::move(sub));
 			});
 		pool.waitAllTasksDone();
 	}
 	else {
-		locateAnchor(pool, depth, task_id, root, interval); // Fallback to sequential search
+		locateAnchor(pool, depth, task_id, root, interval, std::move(sub)); // Fallback to sequential search
 	}
 	RareMatchPairs first_anchors = root->rare_match_pairs;
 	saveRareMatchPairsToCSV(first_anchors, joinPaths(save_file_path, FIRST_ANCHOR_NAME), first_seq_len);
@@ -338,16 +732,240 @@ RareMatchPairs AnchorFinder::lanuchAnchorSearching() {
 	saveRareMatchPairsToCSV(final_anchors, joinPaths(save_file_path, FINAL_ANCHOR_NAME), first_seq_len);
 
 	logger.info() << "New sub suffix array length is " << total_sub_suffix_array - (first_seq_len + second_seq_len) << ". Compared to a multiple of the original sequence length is " << (float)(total_sub_suffix_array - (first_seq_len + second_seq_len)) / (first_seq_len + second_seq_len) << std::endl;
+	logger.info() << "The LCP values of the sub suffix arrays are derived from " << total_scan_segments << " scanned segments ("
+		<< total_scanned_entries << " entries) and " << total_rmq_segments << " RMQ segments (" << total_rmq_queries << (rmq->scanEntries() ? " prefetched" : "") << " queries)" << std::endl;
+	if (max_pairs_per_match) {
+		logger.info() << total_pruned_pairs << " rare match pairs are pruned by the limit of " << max_pairs_per_match << " pairs per match" << std::endl;
+	}
+	else if (adaptive_match_count) {
+		logger.info() << total_pruned_pairs << " rare match pairs of intervals searched again are pruned by the limit of " << max_match_count << " pairs per match" << std::endl;
+	}
+	logger.info() << total_array_tasks << " intervals are anchored by sub suffix arrays in " << total_array_nanoseconds / 1e9 << " s and "
+		<< total_kmer_tasks << " intervals of at most " << kmer_interval_size << " bases by k-mers in " << total_kmer_nanoseconds / 1e9 << " s" << std::endl;
+	logger.info() << total_rare_tasks << " intervals have rare matches, in rare intervals of size " << (total_rare_tasks ? (double)total_match_count / total_rare_tasks : 0)
+		<< " on average" << (adaptive_match_count ? ", " + std::to_string(total_raised_tasks) + " of them larger than " + std::to_string(max_match_count)
+			+ " (" + std::to_string(total_retried_tasks) + " found by searching again)" : "")
+		<< ", and " << total_anchorless_tasks << " intervals of " << total_anchorless_bases << " bases have no anchor" << std::endl;
+	if (cost_model.enabled) {
+		logger.info() << total_cutoff_tasks << " intervals of " << total_cutoff_bases << " bases are cut off by the cost model and aligned as a whole" << std::endl;
+	}
+	if (repeat_anchors) {
+		logger.info() << total_repeat_tasks << " intervals without rare matches are anchored by " << total_repeat_pairs << " repeat matches" << std::endl;
+	}
 	delete root; // Clean up the root anchor
 	logger.info() << "Finish searching anchors" << std::endl;
 
+	// The search may finish before the index is written
+	waitForSave();
+
 	return final_anchors;
 }
 
+// The LCP of two neighbouring ranks a < b is the minimum of LCP[a + 1 .. b]. The ranks are split
+// into segments of SUB_LCP_SEGMENT; at shallow depths they are dense, and reading the LCP bytes
+// between them in order is cheaper than one query per rank. A segment is scanned if it spans at most
+// rmq->scanEntries() entries per rank. Sparse segments use the RMQ structure, with the gathers of SA
+// and the sample and parenthesis words the succinct queries start from prefetched a few ranks ahead.
+// Backends whose queries are as fast as a scan (scanEntries() == 0, the sparse table) answer every
+// rank by a plain query.
+void AnchorFinder::deriveSubArrays(const std::vector<uint_t>& ranks, std::vector<uint_t>& new_SA, std::vector<int_t>& new_LCP, SubLCPStats& stats, uint_t thread_count) const {
+	if (ranks.empty()) return;
+	new_SA[0] = SA[ranks[0]];
+	new_LCP[0] = 0;
+
+	int64_t n = ranks.size();
+	int64_t segment_num = (n - 1 + SUB_LCP_SEGMENT - 1) / SUB_LCP_SEGMENT;
+	uint64_t scan_entries = rmq->scanEntries();
+	bool scan_or_prefetch = scan_entries > 0;
+	uint64_t scan_segments = 0, scanned_entries = 0, rmq_segments = 0, rmq_queries = 0;
+	int threads = getMaxValue(thread_count, (uint_t)1);
+#pragma omp parallel for schedule(dynamic) reduction(+:scan_segments, scanned_entries, rmq_segments, rmq_queries) if(segment_num > 1 && threads > 1) num_threads(threads)
+	for (int64_t s = 0; s < segment_num; ++s) {
+		int64_t first = 1 + s * SUB_LCP_SEGMENT;
+		int64_t last = getMinValue(first + SUB_LCP_SEGMENT, n);
+		uint_t from = ranks[first - 1], to = ranks[last - 1];
+		if (scan_or_prefetch && (uint64_t)(to - from) <= (uint64_t)(last - first) * scan_entries) {
+			for (int64_t i = first; i < last; ++i) {
+				new_SA[i] = SA[ranks[i]];
+				new_LCP[i] = compressed_LCP.rangeMin(ranks[i - 1] + 1, ranks[i]);
+			}
+			++scan_segments;
+			scanned_entries += to - from;
+		}
+		else {
+			for (int64_t i = first; i < last; ++i) {
+				int64_t ahead = i + SUB_LCP_PREFETCH_DISTANCE;
+				if (scan_or_prefetch && ahead < last) {
+					__builtin_prefetch(&SA[ranks[ahead]]);
+					rmq->prefetch(ranks[ahead - 1] + 1, ranks[ahead]);
+				}
+				new_SA[i] = SA[ranks[i]];
+				new_LCP[i] = rmq->queryMin(ranks[i - 1] + 1, ranks[i]);
+			}
+			++rmq_segments;
+			rmq_queries += last - first;
+		}
+	}
+	stats.scan_segments = scan_segments;
+	stats.scanned_entries = scanned_entries;
+	stats.rmq_segments = rmq_segments;
+	stats.rmq_queries = rmq_queries;
+}
+
+SubSuffixArray AnchorFinder::rankSubArrays(const Interval& interval, SubLCPStats& stats, uint_t thread_count) const {
+	uint_t first_seq_start = interval.pos1;
+	uint_t second_seq_start = interval.pos2 + first_seq_len + 1;
+	uint_t new_array_len = interval.len1 + interval.len2;
+
+	// Prepare arrays to hold new SA and LCP values.
+	std::vector<uint_t> new_index_of_SA;
+	new_index_of_SA.reserve(new_array_len);
+
+	for (uint_t i = first_seq_start; i < first_seq_start + interval.len1; i++) {
+		new_index_of_SA.emplace_back(ISA[i]);
+	}
+	for (uint_t i = second_seq_start; i < second_seq_start + interval.len2; i++) {
+		new_index_of_SA.emplace_back(ISA[i]);
+	}
+
+	// Sort the new SA indices to maintain the order.
+	std::sort(new_index_of_SA.begin(), new_index_of_SA.end());
+
+	SubSuffixArray sub;
+	sub.SA.resize(new_array_len);
+	sub.LCP.resize(new_array_len);
+	deriveSubArrays(new_index_of_SA, sub.SA, sub.LCP, stats, thread_count);
+	return sub;
+}
+
+// The root interval holds every suffix but the terminator and both separators, so no ISA is needed.
+SubSuffixArray AnchorFinder::rootSubArrays() const {
+	SubSuffixArray root;
+	root.SA.reserve(concat_data_length - 3);
+	root.LCP.reserve(concat_data_length - 3);
+	int_t low = 0;
+	for (uint_t i = 0; i < concat_data_length; ++i) {
+		low = getMinValue(low, compressed_LCP[i]);
+		if (SA[i] == first_seq_len || SA[i] + 2 >= concat_data_length) continue;
+		root.SA.emplace_back(SA[i]);
+		root.LCP.emplace_back(root.LCP.empty() ? 0 : low);
+		low = I_MAX;
+	}
+	return root;
+}
+
+// Filtering keeps the order of the parent, so the children need no sort. The LCP of two suffixes
+// that are neighbours in a child is the minimum of the parent LCP values between them. While the
+// parent is scanned, a monotone stack holds the suffix minima of its LCP values, so each of these
+// minima is a binary search for the first stack entry after the previous suffix of the child.
+std::vector<SubSuffixArray> AnchorFinder::filterSubArrays(const std::vector<uint_t>& new_SA, const std::vector<int_t>& new_LCP, const Intervals& intervals) const {
+	std::vector<SubSuffixArray> children(intervals.size());
+
+	// Ranges of positions of all children in the concatenated text, ordered by their start.
+	// The ranges of one sequence do not overlap.
+	std::vector<std::tuple<uint_t, uint_t, size_t>> ranges;
+	for (size_t c = 0; c < intervals.size(); ++c) {
+		if (intervals[c].len1 == 0 || intervals[c].len2 == 0 || isKmerInterval(intervals[c])) continue;
+		uint_t second_start = intervals[c].pos2 + first_seq_len + 1;
+		ranges.emplace_back(intervals[c].pos1, intervals[c].pos1 + intervals[c].len1, c);
+		ranges.emplace_back(second_start, second_start + intervals[c].len2, c);
+		children[c].SA.reserve(intervals[c].len1 + intervals[c].len2);
+		children[c].LCP.reserve(intervals[c].len1 + intervals[c].len2);
+	}
+	std::sort(ranges.begin(), ranges.end());
+	std::vector<uint_t> starts, ends;
+	std::vector<size_t> owners;
+	for (const auto& range : ranges) {
+		starts.push_back(std::get<0>(range));
+		ends.push_back(std::get<1>(range));
+		owners.push_back(std::get<2>(range));
+	}
+
+	// Returns the child whose interval contains pos, or intervals.size() if there is none.
+	// The binary search is branch-free, since the positions come in suffix order.
+	auto childOf = [&](uint_t pos) {
+		if (starts.empty()) return intervals.size();
+		const uint_t* base = starts.data();
+		for (size_t len = starts.size(); len > 1; len -= len / 2) {
+			base = base[len / 2] <= pos ? base + len / 2 : base;
+		}
+		size_t k = base - starts.data();
+		return *base <= pos && pos < ends[k] ? owners[k] : intervals.size();
+		};
+
+	std::vector<size_t> last(intervals.size(), 0); // Index after the last parent entry taken by each child
+	std::vector<std::pair<size_t, int_t>> stack; // (index, LCP) with increasing values
+	for (size_t j = 0; j < new_SA.size(); ++j) {
+		while (!stack.empty() && stack.back().second >= new_LCP[j]) stack.pop_back();
+		stack.emplace_back(j, new_LCP[j]);
+
+		size_t c = childOf(new_SA[j]);
+		if (c == intervals.size()) continue;
+		int_t lcp = 0;
+		if (!children[c].SA.empty()) {
+			// Minimum of new_LCP[last[c] .. j]
+			auto it = std::lower_bound(stack.begin(), stack.end(), last[c], [](const std::pair<size_t, int_t>& entry, size_t index) {
+				return entry.first < index;
+				});
+			lcp = it->second;
+		}
+		children[c].SA.emplace_back(new_SA[j]);
+		children[c].LCP.emplace_back(lcp);
+		last[c] = j + 1;
+	}
+	return children;
+}
+
+// The samples are searched as locateAnchor searches an interval, with the sub suffix arrays sorted
+// from ISA inside the timing. Filtered arrays are derived from the root in one pass beforehand; their
+// filtering is part of the parent's search, so only the search of the samples themselves is timed.
+void AnchorFinder::measureAnchorCost(const SubSuffixArray& root) {
+	Intervals samples = RecursionCostModel::sampleIntervals(first_seq_len, second_seq_len);
+	std::vector<SubSuffixArray> sample_arrays(samples.size());
+	if (filter_children && !root.SA.empty()) sample_arrays = filterSubArrays(root.SA, root.LCP, samples);
+
+	std::vector<double> bases, nanoseconds;
+	for (size_t i = 0; i < samples.size(); ++i) {
+		const Interval& sample = samples[i];
+		SubSuffixArray& sub = sample_arrays[i];
+		bool kmer_anchors = isKmerInterval(sample);
+		auto start = std::chrono::steady_clock::now();
+		if (!filter_children && !kmer_anchors) {
+			SubLCPStats stats;
+			sub = rankSubArrays(sample, stats, 1);
+		}
+		RareMatchFinder rare_match_finder(text, sub.SA, sub.LCP, sample.pos1, sample.len1, sample.pos2 + first_seq_len + 1, sample.len2, max_pairs_per_match);
+		RareMatchPairs optimal_pairs = kmer_anchors ? rare_match_finder.findKmerMatch(max_match_count) : rare_match_finder.findRareMatch(max_match_count);
+		nanoseconds.emplace_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+		bases.emplace_back((double)sample.len1 + sample.len2);
+	}
+	RecursionCostModel::fitLine(bases, nanoseconds, cost_model.anchor_task_ns, cost_model.anchor_base_ns);
+	logger.info() << "The anchor search of " << samples.size() << " sample intervals takes " << cost_model.anchor_task_ns << " ns per interval and "
+		<< cost_model.anchor_base_ns << " ns per base" << std::endl;
+}
+
+// findRareMatch keeps only the rare intervals of the smallest size, so a smaller k finds the same
+// matches or none at all. Short deep intervals, which often lie in repeats, are therefore searched
+// with a higher ceiling. Each match of size k may emit up to k * k pairs, so the ceiling is raised
+// up front only as far as the interval is short; long intervals are raised by raisedMatchCount
+// only when they have no rare match at all, with their pairs per match bounded.
+uint_t AnchorFinder::matchCountLimit(const Interval& interval, uint_t depth) const {
+	uint64_t length = getMaxValue((uint64_t)interval.len1 + interval.len2, (uint64_t)1);
+	uint64_t factor = getMinValue((uint64_t)1 << getMinValue(depth, (uint_t)ADAPTIVE_MATCH_MAX_DEPTH), getMaxValue((uint64_t)ADAPTIVE_MATCH_LENGTH / length, (uint64_t)1));
+	// A large max_match_count is not raised past U_MAX
+	return max_match_count > U_MAX / factor ? U_MAX : (uint_t)(max_match_count * factor);
+}
+
+uint_t AnchorFinder::raisedMatchCount(uint_t depth) const {
+	uint64_t factor = (uint64_t)1 << getMinValue(depth, (uint_t)ADAPTIVE_MATCH_MAX_DEPTH);
+	return max_match_count > U_MAX / factor ? U_MAX : (uint_t)(max_match_count * factor);
+}
+
 // Launches the process of locating anchors within given intervals of two sequences.
 // The method explores the given intervals, constructs new arrays based on the ISA,
 // sorts them, and finds rare matches to determine new intervals for further exploration.
-void AnchorFinder::locateAnchor(ThreadPool& pool, uint_t depth, uint_t task_id, Anchor* root, Interval interval) {
+// With filter_children the new arrays are passed in by the parent task instead.
+void AnchorFinder::locateAnchor(ThreadPool& pool, uint_t depth, uint_t task_id, Anchor* root, Interval interval, SubSuffixArray sub) {
 	// Log the start of a new task with its depth and task ID for debugging.
 	logger.debug() << "Task " << task_id << " of depth " << depth << " begins" << std::endl;
 
@@ -368,67 +986,82 @@ void AnchorFinder::locateAnchor(ThreadPool& pool, uint_t depth, uint_t task_id,
 	uint_t new_array_len = fst_len + scd_len;
 	increment_count(total_sub_suffix_array, new_array_len);
 
-	// Prepare arrays to hold new SA, LCP, and DA values.
-	std::vector<uint_t> new_index_of_SA;
-	new_index_of_SA.reserve(new_array_len);
-
-	for (uint_t i = first_seq_start; i < first_seq_start + fst_len; i++) {
-		new_index_of_SA.emplace_back(ISA[i]);
+	// Create and populate new SA and LCP arrays.
+	// The origin of each suffix is derived from its position by RareMatchFinder.
+	// Small intervals are anchored by k-mers of the text and get no arrays.
+	bool kmer_anchors = isKmerInterval(interval);
+	auto start = std::chrono::steady_clock::now();
+	// The root task runs alone in the pool, so only it uses all threads; deeper tasks run beside
+	// their siblings on the pool threads and work serially.
+	uint_t task_threads = depth == 0 ? thread_num : 1;
+	std::vector<uint_t> new_SA;
+	std::vector<int_t> new_LCP;
+	if (filter_children || kmer_anchors) {
+		new_SA = std::move(sub.SA);
+		new_LCP = std::move(sub.LCP);
 	}
-	for (uint_t i = second_seq_start; i < second_seq_start + scd_len; i++) {
-		new_index_of_SA.emplace_back(ISA[i]);
+	else {
+		SubLCPStats stats;
+		SubSuffixArray ranked = rankSubArrays(interval, stats, task_threads);
+		new_SA = std::move(ranked.SA);
+		new_LCP = std::move(ranked.LCP);
+		logger.debug() << "Task " << task_id << " of depth " << depth << " derives " << new_array_len << " LCP values from "
+			<< stats.scan_segments << " scanned segments (" << stats.scanned_entries << " entries) and "
+			<< stats.rmq_segments << " RMQ segments (" << stats.rmq_queries << (rmq->scanEntries() ? " prefetched" : "") << " queries)" << std::endl;
+		total_scan_segments += stats.scan_segments;
+		total_scanned_entries += stats.scanned_entries;
+		total_rmq_segments += stats.rmq_segments;
+		total_rmq_queries += stats.rmq_queries;
 	}
 
-	// Sort the new SA indices to maintain the order.
-	std::sort(new_index_of_SA.begin(), new_index_of_SA.end());
+	// Initialize RareMatchFinder and find optimal rare match pairs.
+	RareMatchFinder rare_match_finder(text, new_SA, new_LCP, first_seq_start, fst_len, second_seq_start, scd_len, max_pairs_per_match, task_threads);
+	uint_t match_count = adaptive_match_count ? matchCountLimit(interval, depth) : max_match_count;
+	RareMatchPairs optimal_pairs = kmer_anchors ? rare_match_finder.findKmerMatch(match_count) : rare_match_finder.findRareMatch(match_count);
+	total_pruned_pairs += rare_match_finder.prunedPairNum();
+	uint_t rare_interval_size = rare_match_finder.rareIntervalSize();
+
+	// A long interval without rare matches is searched again with the depth-raised k. Its matches
+	// keep at most max_pairs_per_match pairs, or max_match_count without a limit, nearest to the diagonal.
+	uint_t raised_count = adaptive_match_count ? raisedMatchCount(depth) : 0;
+	if (optimal_pairs.empty() && raised_count > match_count) {
+		uint_t raised_pairs = max_pairs_per_match ? max_pairs_per_match : max_match_count;
+		RareMatchFinder raised_finder(text, new_SA, new_LCP, first_seq_start, fst_len, second_seq_start, scd_len, raised_pairs, task_threads);
+		optimal_pairs = kmer_anchors ? raised_finder.findKmerMatch(raised_count) : raised_finder.findRareMatch(raised_count);
+		total_pruned_pairs += raised_finder.prunedPairNum();
+		rare_interval_size = raised_finder.rareIntervalSize();
+		total_retried_tasks += !optimal_pairs.empty();
+	}
+	if (!optimal_pairs.empty()) {
+		for (RareMatchPair& pair : optimal_pairs) pair.match_count = rare_interval_size;
+		++total_rare_tasks;
+		total_match_count += rare_interval_size;
+		total_raised_tasks += rare_interval_size > max_match_count;
+	}
 
-	// Create and populate new SA, LCP, and DA arrays based on the sorted indices.
-	std::vector<uint_t> new_SA;
-	std::vector<int_t> new_LCP;
-	std::vector<int_da> new_DA;
-	/*new_SA.reserve(new_array_len);
-	new_LCP.reserve(new_array_len);
-	new_DA.reserve(new_array_len);
-
-	if (!new_index_of_SA.empty()) {
-		uint_t last_index = new_index_of_SA[0];
-		new_SA.emplace_back(SA[last_index]);
-		new_DA.emplace_back(DA[last_index]);
-		new_LCP.emplace_back(0);
-
-		for (size_t i = 1; i < new_index_of_SA.size(); ++i) {
-			auto index = new_index_of_SA[i];
-			new_SA.emplace_back(SA[index]);
-			new_DA.emplace_back(DA[index]);
-			new_LCP.emplace_back(rmq.queryMin(last_index + 1, index));
-			last_index = index;
+	// Without rare matches, the interval would be aligned as a whole; its repeats can still split it.
+	if (optimal_pairs.empty() && repeat_anchors) {
+		optimal_pairs = rare_match_finder.findRepeatMatch();
+		if (!optimal_pairs.empty()) {
+			++total_repeat_tasks;
+			total_repeat_pairs += optimal_pairs.size();
 		}
-	}*/
-	new_SA.resize(new_array_len);
-	new_LCP.resize(new_array_len);
-	new_DA.resize(new_array_len);
-
-	if (!new_index_of_SA.empty()) {
-		uint_t last_index = new_index_of_SA[0];
-		new_SA[0] = SA[last_index];
-		new_DA[0] = DA[last_index];
-		new_LCP[0] = 0;
-#pragma omp parallel for
-		for (size_t i = 1; i < new_index_of_SA.size(); ++i) {
-			auto index = new_index_of_SA[i];
-			new_SA[i] = SA[index];
-			new_DA[i] = DA[index];
-			new_LCP[i] = rmq.queryMin(new_index_of_SA[i - 1] + 1, index);
-		}
-
+	}
+	uint64_t nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	if (kmer_anchors) {
+		++total_kmer_tasks;
+		total_kmer_nanoseconds += nanoseconds;
+	}
+	else {
+		++total_array_tasks;
+		total_array_nanoseconds += nanoseconds;
 	}
 
-	// Initialize RareMatchFinder and find optimal rare match pairs.
-	RareMatchFinder rare_match_finder(concat_data, new_SA, new_LCP, new_DA, first_seq_start, fst_len, second_seq_start, scd_len);
-	RareMatchPairs optimal_pairs = rare_match_finder.findRareMatch(max_match_count);
-
-	if (optimal_pairs.empty())
+	if (optimal_pairs.empty()) {
+		++total_anchorless_tasks;
+		total_anchorless_bases += new_array_len;
 		return;
+	}
 
 	// Convert rare match pairs to intervals for further exploration.
 	Intervals rare_match_intervals = RareMatchPairs2Intervals(optimal_pairs, interval, this->first_seq_len);
@@ -436,20 +1069,51 @@ void AnchorFinder::locateAnchor(ThreadPool& pool, uint_t depth, uint_t task_id,
 	// Update the anchor's rare match pairs with the optimal ones found.
 	root->rare_match_pairs = optimal_pairs;
 
+	// Children predicted to be aligned faster than searched are not split further.
+	std::vector<bool> cut_off(rare_match_intervals.size());
+	Intervals searched_intervals;
+	for (size_t c = 0; c < rare_match_intervals.size(); ++c) {
+		const Interval& child = rare_match_intervals[c];
+		cut_off[c] = cost_model.cutsOff(child);
+		if (cut_off[c]) {
+			++total_cutoff_tasks;
+			total_cutoff_bases += (uint64_t)child.len1 + child.len2;
+		}
+		else {
+			searched_intervals.emplace_back(child);
+		}
+	}
+
+	// Split the sub suffix array among the searched children and release it before they start.
+	std::vector<SubSuffixArray> child_arrays(searched_intervals.size());
+	if (filter_children) {
+		child_arrays = filterSubArrays(new_SA, new_LCP, searched_intervals);
+		logger.debug() << "Task " << task_id << " of depth " << depth << " filters " << new_SA.size() << " suffixes into "
+			<< child_arrays.size() << " children" << std::endl;
+		std::vector<uint_t>().swap(new_SA);
+		std::vector<int_t>().swap(new_LCP);
+	}
+
 	// Recursively explore further intervals with new anchors.
 	uint_t new_task_id = 0;
+	size_t searched_id = 0;
 
 	for (const auto& new_interval : rare_match_intervals) {
 		Anchor* new_anchor = new Anchor(new_depth, root);
 		root->children.emplace_back(new_anchor);
+		if (cut_off[new_task_id]) {
+			new_task_id++;
+			continue;
+		}
+		SubSuffixArray& child = child_arrays[searched_id++];
 		// Parallel or sequential execution based on configuration.
 		if (thread_num) {
-			pool.enqueue([this, &pool, new_depth, new_task_id, new_anchor, new_interval]() {
-				this->locateAnchor(pool, new_depth, new_task_id, new_anchor, new_interval);
+			pool.enqueue([this, &pool, new_depth, new_task_id, new_anchor, new_interval, child = std::move(child)]() mutable {
+				this->locateAnchor(pool, new_depth, new_task_id, new_anchor, new_interval, std::move(child));
 				});
 		}
 		else {
-			locateAnchor(pool, new_depth, new_task_id, new_anchor, new_interval);
+			locateAnchor(pool, new_depth, new_task_id, new_anchor, new_interval, std::move(child));
 		}
 		new_task_id++;
 	}
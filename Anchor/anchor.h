@@ -26,15 +26,46 @@
 #include "rare_match.h"
 #include "threadpool.h"
 #include "RMQ.h"
+#include "succinct_rmq.h"
+#include "compressed_lcp.h"
+#include "parallel_sa.h"
+#include "packed_text.h"
+#include "external_sa.h"
+#include "mapped_file.h"
+#include "reference_index.h"
 #include <thread>
 #include <mutex>
+#include <memory>
+#include <atomic>
 #include <omp.h>
 
 #define SAVE_DIR "save"
 #define ANCHORFINDER_NAME "anchorfinder.bin"
+// anchorfinder.bin starts with this magic and format version; files of other versions are rebuilt.
+#define ANCHORFINDER_MAGIC "RaMAIDX"
+#define ANCHORFINDER_VERSION 4
+// Indexes in the shared cache directory are named ANCHORFINDER_CACHE_PREFIX<key in hex>.bin
+#define ANCHORFINDER_CACHE_PREFIX "anchorfinder_"
 #define FIRST_ANCHOR_NAME "first_anchor.csv"
 #define FINAL_ANCHOR_NAME "final_anchor.csv"
 
+// Number of consecutive ranks of a sub suffix array whose LCP values are derived by the same path.
+#define SUB_LCP_SEGMENT 256
+// Number of ranks the prefetches run ahead of the range minimum queries.
+#define SUB_LCP_PREFETCH_DISTANCE 8
+
+// With adaptive_match_count, intervals of at most ADAPTIVE_MATCH_LENGTH / 2 bases raise k by the factor
+// by which they are shorter than ADAPTIVE_MATCH_LENGTH, at most 2 to the depth, up to this power.
+// Longer intervals without rare matches are searched again with k raised by 2 to the depth.
+#define ADAPTIVE_MATCH_LENGTH (1 << 12)
+#define ADAPTIVE_MATCH_MAX_DEPTH 4
+
+// The recursion cutoff is calibrated on sample intervals of COST_SAMPLE_SIZES lengths per sequence,
+// doubling from COST_SAMPLE_MIN_LENGTH, with COST_SAMPLES_PER_SIZE disjoint samples of each length.
+#define COST_SAMPLE_MIN_LENGTH 32
+#define COST_SAMPLE_SIZES 6
+#define COST_SAMPLES_PER_SIZE 8
+
 extern std::mutex mtx;
 extern uint_t total_sub_suffix_array;  // Counter for the total number of sub suffix arrays
 
@@ -54,6 +85,59 @@ struct Interval
 
 using Intervals = std::vector<Interval>;
 
+// SA and LCP of the suffixes starting in an interval, in the order of the global suffix array
+struct SubSuffixArray {
+	std::vector<uint_t> SA;
+	std::vector<int_t> LCP;
+};
+
+// Paths taken to derive the LCP values of the sub suffix arrays
+struct SubLCPStats {
+	uint64_t scan_segments = 0; // Segments derived by a linear scan
+	uint64_t scanned_entries = 0; // LCP entries read by the scans
+	uint64_t rmq_segments = 0; // Segments derived by range minimum queries
+	uint64_t rmq_queries = 0; // Range minimum queries of these segments
+};
+
+// Cost model of the recursion cutoff. Aligning an interval of n and m bases by wavefront alignment
+// is predicted to take wavefront_task_ns + wavefront_cell_ns * n * m nanoseconds, and searching it
+// for anchors anchor_task_ns + anchor_base_ns * (n + m). Splitting an interval costs at least its
+// search, so an interval predicted to be aligned faster than that is aligned as a whole.
+struct RecursionCostModel {
+	bool enabled = false; // Whether intervals are cut off
+	bool calibrate = false; // Whether the costs are measured on the input before the anchor search
+	double wavefront_task_ns = 0;
+	double wavefront_cell_ns = 0;
+	double anchor_task_ns = 0;
+	double anchor_base_ns = 0;
+
+	double wavefrontCost(const Interval& interval) const {
+		return wavefront_task_ns + wavefront_cell_ns * interval.len1 * interval.len2;
+	}
+
+	double anchorCost(const Interval& interval) const {
+		return anchor_task_ns + anchor_base_ns * ((double)interval.len1 + interval.len2);
+	}
+
+	// Whether an interval is aligned as a whole. Intervals with an empty side are never searched anyway.
+	bool cutsOff(const Interval& interval) const {
+		return enabled && interval.len1 && interval.len2 && wavefrontCost(interval) < anchorCost(interval);
+	}
+
+	// Largest n for which intervals of n bases in both sequences are cut off, 0 if there is none
+	uint_t balancedThreshold() const;
+
+	// Disjoint sample intervals of sequences of the given lengths, spread over them
+	static Intervals sampleIntervals(uint_t first_len, uint_t second_len);
+
+	// Fits time = a + b * x to the samples by least squares of the relative errors, keeping a non-negative and b positive
+	static void fitLine(const std::vector<double>& x, const std::vector<double>& time, double& a, double& b);
+};
+
+// Parses the cost model of --wfa_cutoff: auto to calibrate it, or its four costs separated by commas
+// in the order wavefront_task_ns, wavefront_cell_ns, anchor_task_ns, anchor_base_ns
+bool parseCostModel(const std::string& value, RecursionCostModel& model);
+
 void saveIntervalsToCSV(const Intervals& intervals, const std::string& filename);
 
 struct Anchor {
@@ -93,6 +177,26 @@ struct Anchor {
 	}
 };
 
+// Options of AnchorFinder, which is configured only through this struct. The defaults run
+// sequentially and keep the index in memory only.
+struct AnchorFinderOptions {
+	uint_t thread_num = 0; // Threads of the index construction and the anchor search, 0 for a sequential run
+	bool load_from_disk = false; // Whether a saved index is mapped instead of built
+	bool save_to_disk = false; // Whether the built index is saved
+	uint_t max_match_count = 100; // Maximum number of occurrences of a rare match
+	SAAlgorithm sa_algorithm = SAAlgorithm::AUTO; // Engine of the SA and LCP construction, AUTO picks it from thread_num
+	size_t memory_budget = 0; // Bytes for the text, SA, LCP, ISA and the RMQ structure, 0 means unlimited
+	std::string tmp_dir; // Scratch directory of the disk-backed arrays, empty for the save directory
+	std::string index_cache_dir; // Shared directory of indexes named by their key, empty if no cache is used
+	std::string ref_index_path; // Reference-only index file, empty if not used
+	RMQType rmq_type = RMQType::SPARSE_TABLE; // RMQ structure over the LCP array, may become SUCCINCT under memory_budget
+	bool filter_children = false; // Whether child intervals filter the sub suffix array of their parent
+	uint_t max_pairs_per_match = 0; // Maximum number of pairs emitted for one rare match, 0 means unlimited
+	uint_t kmer_interval_size = 0; // Intervals of at most this many bases are anchored by k-mers, 0 means never
+	bool repeat_anchors = false; // Whether intervals without rare matches are anchored by their repeats
+	bool adaptive_match_count = false; // Whether max_match_count is raised by length and depth, up to 16 times, see matchCountLimit
+	RecursionCostModel cost_model; // Costs by which the recursion stops, disabled by default
+};
 
 
 class AnchorFinder : public Serializable {
@@ -103,7 +207,49 @@ private:
 
 	uint_t max_match_count; // Maximum number of rare matches to find
 
-	unsigned char* concat_data; // Concatenated sequence data
+	uint_t max_pairs_per_match; // Maximum number of pairs emitted for one rare match, 0 means unlimited
+
+	// Intervals of at most this many bases are anchored by k-mers instead of sub suffix arrays, 0 means never
+	uint_t kmer_interval_size;
+
+	// Whether intervals without rare matches are anchored by the exact matches of their repeats
+	bool repeat_anchors;
+
+	// Whether k, the maximum number of rare matches, grows with the depth for short intervals and for
+	// long intervals without rare matches, instead of being max_match_count for all intervals
+	bool adaptive_match_count;
+
+	// Predicted costs by which the recursion stops at intervals that are aligned faster than searched
+	RecursionCostModel cost_model;
+
+	SAAlgorithm sa_algorithm; // Engine used to construct SA and LCP
+
+	size_t memory_budget; // Memory budget in bytes for the text, SA, LCP, ISA and the RMQ structure, 0 means unlimited
+
+	// Whether child intervals get their sub suffix arrays by filtering the parent's one instead of
+	// sorting their ranks from ISA. ISA is not used by the search then and is released early.
+	bool filter_children;
+	std::string tmp_dir; // Scratch directory for the disk-backed arrays
+	bool semi_external; // Whether SA, LCP and ISA live in memory-mapped scratch files
+
+	// Scratch files backing SA, LCP and ISA in semi-external mode
+	MappedFile sa_file, lcp_file, isa_file;
+
+	std::string index_cache_dir; // Shared directory of indexes named by their key, empty if no cache is used
+	std::string ref_index_path; // Reference-only index the query suffixes are merged into, empty if not used
+	uint64_t ref_index_key; // Hash of the reference sequence identifying its reference index
+	uint64_t index_key; // Hash of both sequences, the RMQ type, the uint_t width and the format version
+
+	// Writes anchorfinder.bin in the background while the anchors are searched
+	std::thread save_thread;
+
+	// anchorfinder.bin mapped read-only when the index is loaded; SA, ISA, the text,
+	// the compressed LCP and the RMQ structure are then used in place from the mapping
+	MappedFile index_file;
+
+	unsigned char* concat_data; // Concatenated sequence data, only kept until the suffix array is built
+
+	PackedText text; // Concatenated sequence data used by the anchor search (2 bits per base for DNA)
 
 	uint_t concat_data_length; // Total length of the concatenated data
 	uint_t first_seq_len; // Length of the first sequence
@@ -111,19 +257,40 @@ private:
 
 	uint_t* SA; // Suffix Array
 
-	int_t* LCP; // Longest Common Prefix array
+	int_t* LCP; // Longest Common Prefix array, only kept until it is compressed
 
-	int_da* DA; // Document Array indicating the origin sequence of each suffix
+	CompressedLCP compressed_LCP; // LCP array with one byte per entry used by the anchor search
 
 	uint_t* ISA; // Inverse Suffix Array
 
-	LinearSparseTable rmq; // Range Minimum Query structure for LCP queries
+	RMQType rmq_type; // Range minimum query structure built over the LCP array
+	std::unique_ptr<RangeMinQuery> rmq; // Range Minimum Query structure for LCP queries
+
+	// Totals of the paths taken by all tasks, reported at the end of the anchor search
+	std::atomic<uint64_t> total_scan_segments, total_scanned_entries, total_rmq_segments, total_rmq_queries;
+	std::atomic<uint64_t> total_pruned_pairs; // Rare match pairs dropped by max_pairs_per_match
+	// Tasks anchored by sub suffix arrays and by k-mers, and the time spent on their anchors
+	std::atomic<uint64_t> total_array_tasks, total_array_nanoseconds, total_kmer_tasks, total_kmer_nanoseconds;
+	std::atomic<uint64_t> total_repeat_tasks, total_repeat_pairs; // Intervals anchored by repeat_anchors and their anchors
+	// Tasks with rare matches, the sum of the sizes of their rare intervals, those whose size exceeds
+	// max_match_count, those found by the search again with raisedMatchCount, and those left without anchors
+	std::atomic<uint64_t> total_rare_tasks, total_match_count, total_raised_tasks, total_retried_tasks, total_anchorless_tasks, total_anchorless_bases;
+	std::atomic<uint64_t> total_cutoff_tasks, total_cutoff_bases; // Intervals left unsplit by cost_model and their bases
 
 	// Concatenates sequences from provided data
 	void concatSequence(std::vector<SequenceInfo>& data);
 
-	// Prints debug information including SA, LCP, and DA
-	void printDebugInfo(const uint_t* SA, const int_t* LCP, const int_da* DA, uint_t concat_data_length);
+	// Replaces the byte concatenated data with the packed text
+	void packConcatSequence();
+
+	// Prints debug information including SA, LCP, and the derived DA
+	void printDebugInfo(const uint_t* SA, const CompressedLCP& LCP, uint_t concat_data_length);
+
+	// Returns the document of the suffix starting at pos, as the Document Array of gsacak would:
+	// 0 for the first sequence and its separator, 1 for the second one, 2 for the terminator.
+	int_da documentOf(uint_t pos) const {
+		return pos <= first_seq_len ? 0 : (pos + 1 < concat_data_length ? 1 : 2);
+	}
 
 	// Serialization of AnchorFinder state to an output stream
 	void serialize(std::ostream& out) const override;
@@ -131,21 +298,95 @@ private:
 	// Deserialization of AnchorFinder state from an input stream
 	void deserialize(std::istream& in) override;
 
+	// Starts writing the index to file_name in save_thread. The index is read-only from now on,
+	// so the anchor search can run at the same time.
+	void saveInBackground(const std::string& file_name);
+
+	// Waits until the background save has finished
+	void waitForSave();
+
+	// Computes the key identifying the index of the given sequences
+	static uint64_t computeIndexKey(const std::vector<SequenceInfo>& data, RMQType rmq_type);
+
+	// Creates an empty RMQ structure of rmq_type to be deserialized or mapped
+	std::unique_ptr<RangeMinQuery> createRMQ() const;
+
+	// Returns the number of bytes an RMQ structure of the given type over n LCP entries holds
+	static size_t estimateRMQBytes(RMQType rmq_type, uint_t n);
+
+	// Maps a saved index and uses it in place. Fails if the file was written for other sequences,
+	// by another format version, with another RMQ type or with another uint_t width.
+	bool mapFromFile(const std::string& file_name);
+
 	// Constructs the Inverse Suffix Array (ISA) for a given range
 	void constructISA(uint_t start, uint_t end);
 
 	// Constructs the ISA in parallel
 	void constructISAParallel(uint_t thread_num);
 
-	// Locates anchors using a given thread pool, recursive depth, and intervals
-	void locateAnchor(ThreadPool& pool, uint_t depth, uint_t task_id, Anchor* root, Interval interval);
+	// Constructs SA and LCP with the selected suffix array engine
+	void constructSuffixArray();
+
+	// Constructs SA and LCP by merging the query suffixes into the reference index, which is
+	// loaded from ref_index_path or built and saved there first
+	void constructFromReferenceIndex();
+
+	// Replaces the full LCP array with the compressed one
+	void compressLCP();
+
+	// Allocates an array of concat_data_length elements, in RAM or in a scratch file
+	template<typename T>
+	T* allocateArray(const std::string& name, MappedFile& file);
+
+	// Number of suffixes sorted at once by the semi-external construction
+	uint_t externalBlockLength() const;
+
+	// Prefix of the scratch files of this process in tmp_dir
+	std::string scratchPrefix() const;
+
+	// Derives SA and LCP of a sub suffix array from the sorted ranks of its suffixes. Dense segments
+	// of ranks are derived by scanning the LCP array, sparse ones by prefetched range minimum queries.
+	// The segments are shared by thread_count threads, 1 for a serial derivation.
+	void deriveSubArrays(const std::vector<uint_t>& ranks, std::vector<uint_t>& new_SA, std::vector<int_t>& new_LCP, SubLCPStats& stats, uint_t thread_count) const;
+
+	// Sorts the ranks of the suffixes of an interval from ISA and derives their SA and LCP values with thread_count threads
+	SubSuffixArray rankSubArrays(const Interval& interval, SubLCPStats& stats, uint_t thread_count) const;
+
+	// Derives the sub suffix array of the root interval, i.e. SA without the separators and the terminator
+	SubSuffixArray rootSubArrays() const;
+
+	// Splits a sub suffix array into the sub suffix arrays of the given child intervals
+	std::vector<SubSuffixArray> filterSubArrays(const std::vector<uint_t>& new_SA, const std::vector<int_t>& new_LCP, const Intervals& intervals) const;
+
+	// k with which an interval of the given depth is searched under adaptive_match_count
+	uint_t matchCountLimit(const Interval& interval, uint_t depth) const;
+
+	// k with which an interval of the given depth is searched again under adaptive_match_count
+	// if it has no rare matches, max_match_count times 2 to the depth
+	uint_t raisedMatchCount(uint_t depth) const;
+
+	// Whether an interval is anchored by k-mers, so it needs no sub suffix array
+	bool isKmerInterval(const Interval& interval) const {
+		return (uint64_t)interval.len1 + interval.len2 <= kmer_interval_size;
+	}
+
+	// Times the anchor search of sample intervals without splitting them and fits its costs in cost_model.
+	// With filter_children root holds the root sub suffix array the samples are filtered from.
+	void measureAnchorCost(const SubSuffixArray& root);
+
+	// Releases ISA once it is neither searched nor saved any more
+	void releaseISA();
+
+	// Locates anchors using a given thread pool, recursive depth, and intervals. With filter_children
+	// the sub suffix array of the interval is passed in sub, otherwise it is derived from ISA.
+	void locateAnchor(ThreadPool& pool, uint_t depth, uint_t task_id, Anchor* root, Interval interval, SubSuffixArray sub);
 
 	RareMatchPairs verifyAnchors(const RareMatchPairs& rare_match_pairs);
 
 
 public:
 	// Constructor initializes AnchorFinder with sequence data and optional parallel processing
-	explicit AnchorFinder(std::vector<SequenceInfo>& data, std::string save_file_path, uint_t thread_num = 0, bool load_from_disk = false, bool save_to_disk = true, uint_t max_match_count = 100);
+	explicit AnchorFinder(std::vector<SequenceInfo>& data, std::string save_file_path, const AnchorFinderOptions& options = AnchorFinderOptions());
 
 	// Destructor cleans up allocated resources
 	~AnchorFinder();
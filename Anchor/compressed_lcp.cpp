@@ -0,0 +1,103 @@
+/*
+ * Copyright [2024] [MALABZ_UESTC Pinglu Zhang]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+ // Author: Pinglu Zhang
+ // Contact: pingluzhang@outlook.com
+ // Created: 2024-11-11
+
+#include "compressed_lcp.h"
+
+CompressedLCP::CompressedLCP(const int_t* LCP, uint_t n) : N(n) {
+	std::vector<uint8_t> values(N);
+	std::vector<std::pair<uint_t, int_t>> large;
+	for (uint_t i = 0; i < N; ++i) {
+		if (LCP[i] < LCP_OVERFLOW_MARK) {
+			values[i] = (uint8_t)LCP[i];
+		}
+		else {
+			values[i] = LCP_OVERFLOW_MARK;
+			large.emplace_back(i, LCP[i]);
+		}
+	}
+	large.shrink_to_fit();
+	small = std::move(values);
+	overflow = std::move(large);
+	buildDirectory();
+}
+
+void CompressedLCP::buildDirectory() {
+	uint_t block_num = (N >> LCP_SAMPLE_SHIFT) + 2;
+	directory.assign(block_num, 0);
+	uint_t k = 0;
+	for (uint_t b = 0; b < block_num; ++b) {
+		while (k < overflow.size() && (overflow[k].first >> LCP_SAMPLE_SHIFT) < b) ++k;
+		directory[b] = k;
+	}
+}
+
+int_t CompressedLCP::overflowValue(uint_t i) const {
+	uint_t b = i >> LCP_SAMPLE_SHIFT;
+	auto first = overflow.begin() + directory[b];
+	auto last = overflow.begin() + directory[b + 1];
+	auto it = std::lower_bound(first, last, i, [](const std::pair<uint_t, int_t>& entry, uint_t index) {
+		return entry.first < index;
+		});
+	return it->second;
+}
+
+int_t CompressedLCP::rangeMin(uint_t l, uint_t r) const {
+	uint8_t low = LCP_OVERFLOW_MARK;
+	for (const uint8_t* p = small.data() + l, *end = small.data() + r + 1; p != end; ++p) {
+		low = std::min(low, *p);
+	}
+	if (low != LCP_OVERFLOW_MARK) return low;
+
+	// Every value of the range is large, so the range is a consecutive run of the overflow table
+	uint_t b = l >> LCP_SAMPLE_SHIFT;
+	auto first = std::lower_bound(overflow.begin() + directory[b], overflow.begin() + directory[b + 1], l,
+		[](const std::pair<uint_t, int_t>& entry, uint_t index) {
+			return entry.first < index;
+		});
+	int_t value = first->second;
+	for (auto it = first + 1; it != first + (r - l + 1); ++it) value = std::min(value, it->second);
+	return value;
+}
+
+size_t CompressedLCP::memoryBytes() const {
+	return small.size() + overflow.size() * sizeof(std::pair<uint_t, int_t>) + directory.size() * sizeof(uint_t);
+}
+
+// Serializes the byte array and the overflow table; the directory is rebuilt on loading.
+void CompressedLCP::serialize(std::ostream& out) const {
+	saveNumber(out, N);
+	saveAlignedArray(out, small);
+	saveAlignedArray(out, overflow);
+}
+
+// Deserializes the array written by serialize.
+void CompressedLCP::deserialize(std::istream& in) {
+	loadNumber(in, N);
+	loadAlignedArray(in, small);
+	loadAlignedArray(in, overflow);
+	buildDirectory();
+}
+
+// Attaches the byte array and the overflow table without copying them; only the directory is rebuilt.
+bool CompressedLCP::map(MappedReader& in) {
+	if (!in.readNumber(N) || !in.readArray(small) || !in.readArray(overflow) || small.size() != N) return false;
+	buildDirectory();
+	return true;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright [2024] [MALABZ_UESTC Pinglu Zhang]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+ // Author: Pinglu Zhang
+ // Contact: pingluzhang@outlook.com
+ // Created: 2024-11-11
+#pragma once
+
+#include "gsacak.h"
+#include "utils.h"
+
+#include <vector>
+
+// Values of at least this size are stored in the overflow table.
+#define LCP_OVERFLOW_MARK 255
+// Number of LCP entries covered by one sample of the overflow directory.
+#define LCP_SAMPLE_SHIFT 12
+
+// LCP array with one byte per entry.
+// Values below LCP_OVERFLOW_MARK are stored directly; larger values are marked in the byte array
+// and kept in an overflow table sorted by index. A sampled directory narrows the binary search in
+// the overflow table to the entries of a single 4096-entry block.
+class CompressedLCP : public Serializable {
+private:
+	uint_t N; // Number of entries
+	MappedArray<uint8_t> small; // Small values, or LCP_OVERFLOW_MARK for large ones
+	MappedArray<std::pair<uint_t, int_t>> overflow; // (index, value) of the large values, sorted by index
+	std::vector<uint_t> directory; // directory[b] is the first overflow entry with index >= b << LCP_SAMPLE_SHIFT
+
+	// Looks up a value in the overflow table
+	int_t overflowValue(uint_t i) const;
+
+	// Builds the sampled directory over the overflow table
+	void buildDirectory();
+
+public:
+	// Default constructor creates an empty array
+	explicit CompressedLCP() : N(0) {}
+
+	// Compresses LCP[0..n-1]
+	explicit CompressedLCP(const int_t* LCP, uint_t n);
+
+	// Returns LCP[i]
+	int_t operator[](uint_t i) const {
+		uint8_t value = small[i];
+		return value != LCP_OVERFLOW_MARK ? value : overflowValue(i);
+	}
+
+	// Returns the minimum of LCP[l..r]. The bytes are scanned in order, so this is cheaper than a
+	// range minimum query when the range is short or the neighbouring ranges are scanned as well.
+	int_t rangeMin(uint_t l, uint_t r) const;
+
+	uint_t size() const { return N; }
+
+	// Returns the number of values kept in the overflow table
+	size_t overflowSize() const { return overflow.size(); }
+
+	// Returns the number of bytes held by the array
+	size_t memoryBytes() const;
+
+	// Serializes the array to an output stream
+	void serialize(std::ostream& out) const override;
+
+	// Deserializes the array from an input stream
+	void deserialize(std::istream& in) override;
+
+	// Uses the array written by serialize in place from a mapped index file
+	bool map(MappedReader& in);
+};
@@ -0,0 +1,196 @@
+/*
+ * Copyright [2024] [MALABZ_UESTC Pinglu Zhang]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+ // Author: Pinglu Zhang
+ // Contact: pingluzhang@outlook.com
+ // Created: 2024-11-08
+
+#include "external_sa.h"
+
+#include <algorithm>
+#include <queue>
+#include <stdexcept>
+
+namespace {
+
+// A suffix in a round of prefix doubling: the names of the two halves of its first 2h characters.
+// The LCP pass stores PHI and the rank of a text position in first and second.
+struct SuffixTriple {
+	uint_t first;
+	uint_t second;
+	uint_t pos;
+
+	bool operator<(const SuffixTriple& other) const {
+		return first != other.first ? first < other.first : second < other.second;
+	}
+};
+
+// Creates a temporary scratch file of n elements and maps it
+template<typename T>
+T* createScratch(MappedFile& file, const std::string& scratch_prefix, const std::string& name, uint64_t n) {
+	std::string file_name = scratch_prefix + name + ".bin";
+	if (!file.create(file_name, n * sizeof(T))) throw std::runtime_error("failed to create the scratch file " + file_name);
+	file.adviseSequential();
+	return static_cast<T*>(file.data());
+}
+
+// Writes out[pos] = value for pairs that cover every position 0 .. n-1 once. A pair is first appended
+// to the region of its block of block_len positions in a scratch file, so the pairs are written as one
+// stream per block; every block is then filled in RAM and written out in one piece.
+class BlockScatter {
+private:
+	uint64_t n;
+	uint64_t block_len;
+	MappedFile file;
+	uint_t* pairs; // Position and value of every pair, the pairs of block b from index b * block_len on
+	std::vector<uint64_t> cursor; // Index of the next pair of each block
+
+public:
+	BlockScatter(uint_t n, uint_t block_len, const std::string& scratch_prefix, const std::string& name) : n(n), block_len(block_len) {
+		pairs = createScratch<uint_t>(file, scratch_prefix, name, 2 * (uint64_t)n);
+		for (uint64_t begin = 0; begin < n; begin += block_len) cursor.emplace_back(begin);
+	}
+
+	void add(uint_t pos, uint_t value) {
+		uint64_t& c = cursor[pos / block_len];
+		pairs[2 * c] = pos;
+		pairs[2 * c + 1] = value;
+		++c;
+	}
+
+	// Writes the values added since the last call and starts over
+	template<typename T>
+	void write(T* out) {
+		std::vector<T> block(block_len);
+		for (uint64_t b = 0, begin = 0; begin < n; ++b, begin += block_len) {
+			uint64_t end = getMinValue(begin + block_len, n);
+			for (uint64_t c = begin; c < cursor[b]; ++c) block[pairs[2 * c] - begin] = (T)pairs[2 * c + 1];
+			std::copy(block.begin(), block.begin() + (end - begin), out + begin);
+		}
+		clear();
+	}
+
+	// Drops the values added since the last write
+	void clear() {
+		for (uint64_t b = 0; b < cursor.size(); ++b) cursor[b] = b * block_len;
+	}
+};
+
+} // namespace
+
+// The names of the first round are the characters. As in gsacak, the separators are distinct and
+// ordered by their position, below every character, and the terminator is the smallest symbol.
+// A suffix whose second half starts behind the text gets the name 0 for it; its first half holds the
+// unique terminator, so that name never decides. The name of a suffix in the next round is the rank of
+// the first suffix with the same two names, and the rounds end once all names differ.
+void semiExternalSACA(const unsigned char* s, uint_t* SA, int_t* LCP, uint_t n, uint_t block_len, const std::string& scratch_prefix) {
+	block_len = getMaxValue(getMinValue(block_len, n), (uint_t)1);
+
+	MappedFile names_file, runs_file;
+	uint_t* names = createScratch<uint_t>(names_file, scratch_prefix, "names", n);
+	SuffixTriple* runs = createScratch<SuffixTriple>(runs_file, scratch_prefix, "runs", n);
+	BlockScatter scatter(n, block_len, scratch_prefix, "pairs");
+
+	uint_t separator_num = std::count(s, s + n, 1);
+	uint_t separator = 0;
+	for (uint_t i = 0; i < n; ++i) {
+		names[i] = s[i] == 0 ? 0 : s[i] == 1 ? ++separator : separator_num + s[i];
+	}
+
+	std::vector<SuffixTriple> block;
+	block.reserve(block_len);
+	uint_t round = 0;
+	for (uint64_t h = 1; ; h *= 2) {
+		++round;
+
+		// Sort the suffixes of every block of text positions in RAM
+		std::vector<uint64_t> run_next, run_end;
+		for (uint64_t begin = 0; begin < n; begin += block_len) {
+			uint64_t end = getMinValue(begin + block_len, (uint64_t)n);
+			block.clear();
+			for (uint64_t i = begin; i < end; ++i) {
+				block.push_back({ names[i], i + h < n ? names[i + h] : 0, (uint_t)i });
+			}
+			std::sort(block.begin(), block.end());
+			std::copy(block.begin(), block.end(), runs + begin);
+			run_next.emplace_back(begin);
+			run_end.emplace_back(end);
+		}
+
+		// Merge the runs, name the suffixes and send the names back to text order
+		auto greater = [runs, &run_next](size_t a, size_t b) { return runs[run_next[b]] < runs[run_next[a]]; };
+		std::priority_queue<size_t, std::vector<size_t>, decltype(greater)> heads(greater);
+		for (size_t r = 0; r < run_next.size(); ++r) heads.push(r);
+		bool distinct = true;
+		SuffixTriple last = { 0, 0, 0 };
+		uint_t name = 0;
+		for (uint_t k = 0; k < n; ++k) {
+			size_t r = heads.top();
+			heads.pop();
+			SuffixTriple t = runs[run_next[r]];
+			if (++run_next[r] < run_end[r]) heads.push(r);
+			if (k == 0 || last < t) name = k;
+			else distinct = false;
+			last = t;
+			SA[k] = t.pos;
+			scatter.add(t.pos, name);
+		}
+		if (distinct) break;
+		scatter.write(names);
+	}
+	scatter.clear();
+	logger.info() << "The suffix array is built in " << round << " doubling rounds over runs of " << block_len << " suffixes" << std::endl;
+
+	// LCP by the PHI algorithm over blocks of text positions. PHI and the rank of every position are
+	// sent to its block, and the LCP values back to the blocks of their ranks. PLCP[p + 1] >= PLCP[p] - 1,
+	// so the length matched at one position carries over to the next, also across blocks.
+	if (LCP) {
+		std::vector<uint64_t> cursor;
+		for (uint64_t begin = 0; begin < n; begin += block_len) cursor.emplace_back(begin);
+		for (uint_t i = 0; i < n; ++i) {
+			runs[cursor[SA[i] / block_len]++] = { i > 0 ? SA[i - 1] : n, i, SA[i] };
+		}
+
+		std::vector<uint_t> phi(block_len), rank(block_len);
+		uint_t l = 0;
+		for (uint64_t begin = 0; begin < n; begin += block_len) {
+			uint64_t end = getMinValue(begin + block_len, (uint64_t)n);
+			for (uint64_t c = begin; c < end; ++c) {
+				phi[runs[c].pos - begin] = runs[c].first;
+				rank[runs[c].pos - begin] = runs[c].second;
+			}
+			for (uint64_t p = begin; p < end; ++p) {
+				uint_t j = phi[p - begin];
+				if (j == n) {
+					l = 0;
+				}
+				else {
+					while (p + l < n && j + l < n && s[p + l] == s[j + l] && s[p + l] > 1) ++l;
+				}
+				scatter.add(rank[p - begin], l);
+				if (l > 0) --l;
+			}
+		}
+		scatter.write(LCP);
+	}
+}
+
+void semiExternalISA(const uint_t* SA, uint_t* ISA, uint_t n, uint_t block_len, const std::string& scratch_prefix) {
+	block_len = getMaxValue(getMinValue(block_len, n), (uint_t)1);
+	BlockScatter scatter(n, block_len, scratch_prefix, "isa_pairs");
+	for (uint_t i = 0; i < n; ++i) scatter.add(SA[i], i);
+	scatter.write(ISA);
+}
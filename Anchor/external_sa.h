@@ -0,0 +1,46 @@
+/*
+ * Copyright [2024] [MALABZ_UESTC Pinglu Zhang]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+ // Author: Pinglu Zhang
+ // Contact: pingluzhang@outlook.com
+ // Created: 2024-11-08
+#pragma once
+
+#include "gsacak.h"
+#include "logging.h"
+#include "utils.h"
+#include "mapped_file.h"
+
+#include <string>
+#include <vector>
+
+// Semi-external construction of the arrays used by AnchorFinder.
+// SA, LCP and ISA live in memory-mapped files on a scratch disk. Only the text and blocks of
+// block_len entries are kept in RAM. All other arrays, including the scratch files, are read and
+// written sequentially or as one sequential stream per block, so the kernel can stream their
+// pages to and from the disk. The scratch files are named scratch_prefix + name + ".bin" and are
+// deleted before the functions return.
+
+// Computes SA by prefix doubling. Every round sorts the suffixes by the names of their first 2h
+// characters: runs of block_len suffixes are sorted in RAM and merged, and the new names are sent
+// back to text order block by block. The number of rounds is logarithmic in the longest repeat.
+// LCP then follows by the PHI algorithm over blocks of text positions.
+// The output is identical to gsacak(s, SA, LCP, nullptr, n); it needs 24 bytes of scratch space per suffix.
+void semiExternalSACA(const unsigned char* s, uint_t* SA, int_t* LCP, uint_t n, uint_t block_len, const std::string& scratch_prefix);
+
+// Computes ISA[SA[i]] = i. The ranks are sent to their blocks of text positions in one pass over SA,
+// then every block is filled in RAM and written sequentially.
+void semiExternalISA(const uint_t* SA, uint_t* ISA, uint_t n, uint_t block_len, const std::string& scratch_prefix);
@@ -0,0 +1,249 @@
+/*
+ * Copyright [2024] [MALABZ_UESTC Pinglu Zhang]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+ // Author: Pinglu Zhang
+ // Contact: pingluzhang@outlook.com
+ // Created: 2024-11-06
+
+#include "packed_text.h"
+
+#if defined(PACKED_TEXT_AVX2) || defined(PACKED_TEXT_SSE2)
+#include <immintrin.h>
+#endif
+
+// Returns the 2-bit code of a nucleotide, or 4 for any other character.
+static inline uint_t baseCode(unsigned char c) {
+	switch (c) {
+	case 'A': return 0;
+	case 'C': return 1;
+	case 'G': return 2;
+	case 'T': return 3;
+	default: return 4;
+	}
+}
+
+// Spreads the lower 32 bits of x to the even bit positions, so bit j moves to bit 2*j.
+static inline uint64_t spreadBits(uint64_t x) {
+	x &= 0xFFFFFFFFULL;
+	x = (x | (x << 16)) & 0x0000FFFF0000FFFFULL;
+	x = (x | (x << 8)) & 0x00FF00FF00FF00FFULL;
+	x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	x = (x | (x << 2)) & 0x3333333333333333ULL;
+	x = (x | (x << 1)) & 0x5555555555555555ULL;
+	return x;
+}
+
+bool PackedText::isPackable(const unsigned char* s, uint_t n) {
+	for (uint_t i = 0; i < n; ++i) {
+		if (s[i] > 1 && baseCode(s[i]) > 3) return false;
+	}
+	return true;
+}
+
+PackedText::PackedText(const unsigned char* s, uint_t n) : length(n), packed(isPackable(s, n)) {
+	if (!packed) {
+		bytes = std::vector<unsigned char>(s, s + n);
+		return;
+	}
+	// One extra word on each array lets baseWord and specialWord read past the last position.
+	bases.assign(n / BASES_PER_WORD + 2, 0);
+	special.assign(n / 64 + 2, 0);
+	for (uint_t i = 0; i < n; ++i) {
+		if (s[i] <= 1) {
+			special[i / 64] |= 1ULL << (i % 64);
+		}
+		else {
+			bases[i / BASES_PER_WORD] |= (uint64_t)baseCode(s[i]) << (2 * (i % BASES_PER_WORD));
+		}
+	}
+}
+
+uint64_t PackedText::baseWord(uint_t p) const {
+	uint_t offset = 2 * (p % BASES_PER_WORD);
+	const uint64_t* word = bases.data() + p / BASES_PER_WORD;
+	if (offset == 0) return word[0];
+	return (word[0] >> offset) | (word[1] << (64 - offset));
+}
+
+uint64_t PackedText::specialBits(uint_t p) const {
+	uint_t offset = p % 64;
+	const uint64_t* word = special.data() + p / 64;
+	uint64_t bits = word[0] >> offset;
+	if (offset > 32) bits |= word[1] << (64 - offset);
+	return bits & 0xFFFFFFFFULL;
+}
+
+bool PackedText::hasSpecialBlock(uint_t p) const {
+	uint_t first = p / 64, last = (p + BASES_PER_BLOCK - 1) / 64;
+	for (uint_t w = first; w <= last; ++w) {
+		uint64_t bits = special[w];
+		if (w == first) bits &= ~0ULL << (p % 64);
+		if (w == last && (p + BASES_PER_BLOCK) % 64) bits &= ~(~0ULL << ((p + BASES_PER_BLOCK) % 64));
+		if (bits) return true;
+	}
+	return false;
+}
+
+#ifdef PACKED_TEXT_AVX2
+// Loads the 2-bit codes of the 128 bases starting at p into four words, as baseWord does for 32.
+// A shift by 64 clears the word, so aligned positions need no special case.
+static inline __m256i loadBaseBlock(const uint64_t* bases, uint_t p) {
+	const uint64_t* word = bases + p / BASES_PER_WORD;
+	__m128i offset = _mm_cvtsi32_si128(2 * (p % BASES_PER_WORD));
+	__m128i rest = _mm_cvtsi32_si128(64 - 2 * (p % BASES_PER_WORD));
+	__m256i low = _mm256_loadu_si256((const __m256i*)word);
+	__m256i high = _mm256_loadu_si256((const __m256i*)(word + 1));
+	return _mm256_or_si256(_mm256_srl_epi64(low, offset), _mm256_sll_epi64(high, rest));
+}
+
+bool PackedText::sameBaseBlock(uint_t p, uint_t q) const {
+	__m256i diff = _mm256_xor_si256(loadBaseBlock(bases.data(), p), loadBaseBlock(bases.data(), q));
+	return _mm256_testz_si256(diff, diff);
+}
+#else
+bool PackedText::sameBaseBlock(uint_t p, uint_t q) const {
+	for (uint_t i = 0; i < BASES_PER_BLOCK; i += BASES_PER_WORD) {
+		if (baseWord(p + i) != baseWord(q + i)) return false;
+	}
+	return true;
+}
+#endif
+
+uint_t PackedText::backwardMatch(uint_t a, uint_t b, uint_t max_len) const {
+	if (!packed) return backwardMatchBytes(a, b, max_len);
+	uint_t k = 0;
+#ifdef PACKED_TEXT_AVX2
+	// Skip whole blocks of 128 equal bases, the block with the mismatch is resolved below
+	while (k + BASES_PER_BLOCK <= max_len && a - k >= BASES_PER_BLOCK && b - k >= BASES_PER_BLOCK) {
+		uint_t pa = a - k - BASES_PER_BLOCK, pb = b - k - BASES_PER_BLOCK;
+		if (!sameBaseBlock(pa, pb) || hasSpecialBlock(pa) || hasSpecialBlock(pb)) break;
+		k += BASES_PER_BLOCK;
+	}
+#endif
+	// Compare 32 bases per step; the mismatch closest to a and b is the highest set 2-bit slot.
+	while (k < max_len && a - k >= BASES_PER_WORD && b - k >= BASES_PER_WORD) {
+		uint_t pa = a - k - BASES_PER_WORD, pb = b - k - BASES_PER_WORD;
+		uint64_t diff = baseWord(pa) ^ baseWord(pb);
+		diff = (diff | (diff >> 1)) & 0x5555555555555555ULL;
+		// Separators are rare, so their bits are only spread when there is one
+		uint64_t specials = specialBits(pa) | specialBits(pb);
+		if (specials) diff |= spreadBits(specials);
+		if (diff) {
+			uint_t slot = (63 - __builtin_clzll(diff)) / 2;
+			return getMinValue(k + (BASES_PER_WORD - 1 - slot), max_len);
+		}
+		k += BASES_PER_WORD;
+	}
+	if (k >= max_len) return max_len;
+	// Character by character near the start of the text.
+	while (k < max_len) {
+		unsigned char c = at(a - k - 1);
+		if (c <= 1 || c != at(b - k - 1)) break;
+		++k;
+	}
+	return k;
+}
+
+// Each step compares the block of characters directly before a - k and b - k. A position fails if the
+// characters differ or the character is a separator or the terminator; the number of equal characters
+// before the failing position closest to a - k follows from the leading zeros of the failure mask.
+uint_t PackedText::backwardMatchBytes(uint_t a, uint_t b, uint_t max_len) const {
+	const unsigned char* text = bytes.data();
+	uint_t k = 0;
+#if defined(PACKED_TEXT_AVX2)
+	const uint_t step = 32;
+	const __m256i one = _mm256_set1_epi8(1);
+	while (k < max_len && a - k >= step && b - k >= step) {
+		__m256i x = _mm256_loadu_si256((const __m256i*)(text + a - k - step));
+		__m256i y = _mm256_loadu_si256((const __m256i*)(text + b - k - step));
+		__m256i same = _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(x, one), x), _mm256_cmpeq_epi8(x, y));
+		uint32_t fail = ~(uint32_t)_mm256_movemask_epi8(same);
+		if (fail) return getMinValue(k + (uint_t)__builtin_clz(fail), max_len);
+		k += step;
+	}
+#elif defined(PACKED_TEXT_SSE2)
+	const uint_t step = 16;
+	const __m128i one = _mm_set1_epi8(1);
+	while (k < max_len && a - k >= step && b - k >= step) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(text + a - k - step));
+		__m128i y = _mm_loadu_si128((const __m128i*)(text + b - k - step));
+		__m128i same = _mm_andnot_si128(_mm_cmpeq_epi8(_mm_min_epu8(x, one), x), _mm_cmpeq_epi8(x, y));
+		uint32_t fail = ~(uint32_t)_mm_movemask_epi8(same) & 0xFFFF;
+		if (fail) return getMinValue(k + (uint_t)__builtin_clz(fail) - 16, max_len);
+		k += step;
+	}
+#else
+	// Bytes are tested exactly for zero: adding 0x7F to the lower 7 bits never carries into the next byte
+	const uint_t step = 8;
+	const uint64_t low = 0x7F7F7F7F7F7F7F7FULL, high = 0x8080808080808080ULL;
+	auto nonzeroBytes = [&](uint64_t v) { return (((v & low) + low) | v) & high; };
+	while (k < max_len && a - k >= step && b - k >= step) {
+		uint64_t x, y;
+		memcpy(&x, text + a - k - step, step);
+		memcpy(&y, text + b - k - step, step);
+		uint64_t fail = nonzeroBytes(x ^ y) | (~nonzeroBytes(x & 0xFEFEFEFEFEFEFEFEULL) & high);
+		if (fail) return getMinValue(k + (uint_t)__builtin_clzll(fail) / 8, max_len);
+		k += step;
+	}
+#endif
+	if (k >= max_len) return max_len;
+	// Character by character near the start of the text.
+	while (k < max_len) {
+		unsigned char c = text[a - k - 1];
+		if (c <= 1 || c != text[b - k - 1]) break;
+		++k;
+	}
+	return k;
+}
+
+size_t PackedText::memoryBytes() const {
+	return bases.size() * sizeof(uint64_t) + special.size() * sizeof(uint64_t) + bytes.size();
+}
+
+// Serializes the text. Packed texts store their words, byte texts store the raw characters.
+void PackedText::serialize(std::ostream& out) const {
+	saveNumber(out, length);
+	saveNumber(out, packed);
+	if (packed) {
+		saveAlignedArray(out, bases);
+		saveAlignedArray(out, special);
+	}
+	else {
+		saveAlignedArray(out, bytes);
+	}
+}
+
+// Deserializes the text written by serialize.
+void PackedText::deserialize(std::istream& in) {
+	loadNumber(in, length);
+	loadNumber(in, packed);
+	if (packed) {
+		loadAlignedArray(in, bases);
+		loadAlignedArray(in, special);
+	}
+	else {
+		loadAlignedArray(in, bytes);
+	}
+}
+
+// Attaches the arrays written by serialize without copying them.
+bool PackedText::map(MappedReader& in) {
+	if (!in.readNumber(length) || !in.readNumber(packed)) return false;
+	if (packed)
+		return in.readArray(bases) && in.readArray(special)
+			&& bases.size() >= length / BASES_PER_WORD + 2 && special.size() >= length / 64 + 2;
+	return in.readArray(bytes) && bytes.size() == length;
+}
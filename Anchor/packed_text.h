@@ -0,0 +1,111 @@
+/*
+ * Copyright [2024] [MALABZ_UESTC Pinglu Zhang]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+ // Author: Pinglu Zhang
+ // Contact: pingluzhang@outlook.com
+ // Created: 2024-11-06
+#pragma once
+
+#include "gsacak.h"
+#include "utils.h"
+
+#include <vector>
+
+// Number of bases stored in one 64-bit word of the packed text.
+#define BASES_PER_WORD 32
+// Number of bases compared per step by the AVX2 kernel of backwardMatch.
+#define BASES_PER_BLOCK 128
+
+// Instruction set of the backwardMatch kernels, that of the build unless NO_SIMD is defined,
+// which selects the portable word-at-a-time kernels.
+#if defined(__AVX2__) && !defined(NO_SIMD)
+#define PACKED_TEXT_AVX2
+#define PACKED_TEXT_KERNEL "AVX2"
+#elif defined(__SSE2__) && !defined(NO_SIMD)
+#define PACKED_TEXT_SSE2
+#define PACKED_TEXT_KERNEL "SSE2"
+#else
+#define PACKED_TEXT_KERNEL "SWAR"
+#endif
+
+// Concatenated text used by the anchor search.
+// DNA texts (A, C, G, T plus the gsacak separators 1 and terminator 0) are stored with 2 bits per base,
+// and a separate bitmap marks the separator and terminator positions. Any other alphabet is kept as
+// plain bytes, so all callers go through the same interface.
+class PackedText : public Serializable {
+private:
+	uint_t length; // Number of characters including separators and the terminator
+	bool packed; // Whether the 2-bit representation is used
+
+	MappedArray<uint64_t> bases; // 2-bit codes, base i is stored at bits 2*(i%32) of word i/32
+	MappedArray<uint64_t> special; // Bitmap of separator and terminator positions
+	MappedArray<unsigned char> bytes; // Byte text for non-DNA alphabets
+
+	// Returns the 2-bit codes of the 32 bases starting at position p.
+	uint64_t baseWord(uint_t p) const;
+
+	// Returns the special bits of the 32 positions starting at position p, one bit per position.
+	uint64_t specialBits(uint_t p) const;
+
+	// Checks whether the 128 positions starting at p hold a separator or the terminator.
+	bool hasSpecialBlock(uint_t p) const;
+
+	// Checks whether the 128 bases starting at p and q are equal, ignoring special positions.
+	bool sameBaseBlock(uint_t p, uint_t q) const;
+
+	// backwardMatch for byte texts; compares 32, 16 or 8 characters per step.
+	uint_t backwardMatchBytes(uint_t a, uint_t b, uint_t max_len) const;
+
+public:
+	// Default constructor creates an empty text
+	explicit PackedText() : length(0), packed(false) {}
+
+	// Builds the text from the concatenated data s[0..n-1] (separators 1, terminated by 0)
+	explicit PackedText(const unsigned char* s, uint_t n);
+
+	// Checks whether s[0..n-1] only holds A, C, G, T, separators and the terminator
+	static bool isPackable(const unsigned char* s, uint_t n);
+
+	// Returns the character at position i (1 for separators, 0 for the terminator)
+	unsigned char at(uint_t i) const {
+		if (!packed) return bytes[i];
+		if ((special[i / 64] >> (i % 64)) & 1) return i + 1 == length ? 0 : 1;
+		return "ACGT"[(bases[i / BASES_PER_WORD] >> (2 * (i % BASES_PER_WORD))) & 3];
+	}
+
+	// Counts how many characters directly before positions a and b are equal,
+	// i.e. the largest k <= max_len with text[a-j] == text[b-j] for all 1 <= j <= k.
+	// Separators and the terminator never match. Requires a >= max_len and b >= max_len.
+	// Packed texts are compared 128 bases per step with AVX2 and 32 bases per step otherwise,
+	// byte texts 32 characters per step with AVX2, 16 with SSE2 and 8 otherwise.
+	uint_t backwardMatch(uint_t a, uint_t b, uint_t max_len) const;
+
+	uint_t size() const { return length; }
+
+	bool isPacked() const { return packed; }
+
+	// Returns the number of bytes held by the text
+	size_t memoryBytes() const;
+
+	// Serializes the text to an output stream
+	void serialize(std::ostream& out) const override;
+
+	// Deserializes the text from an input stream
+	void deserialize(std::istream& in) override;
+
+	// Uses the text written by serialize in place from a mapped index file
+	bool map(MappedReader& in);
+};
@@ -0,0 +1,352 @@
+/*
+ * Copyright [2024] [MALABZ_UESTC Pinglu Zhang]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+ // Author: Pinglu Zhang
+ // Contact: pingluzhang@outlook.com
+ // Created: 2024-11-04
+
+#include "parallel_sa.h"
+
+// A group of suffixes [left, right) in SA that share the same prefix of the current length.
+using SuffixGroup = std::pair<uint_t, uint_t>;
+using SuffixGroups = std::vector<SuffixGroup>;
+
+// Groups smaller than this are always sorted by a single thread.
+#define PARALLEL_SORT_MIN_SIZE (1 << 16)
+
+bool parseSAAlgorithm(const std::string& name, SAAlgorithm& algorithm) {
+	if (name == "auto") {
+		algorithm = SAAlgorithm::AUTO;
+		return true;
+	}
+	if (name == "gsacak") {
+		algorithm = SAAlgorithm::GSACAK;
+		return true;
+	}
+	if (name == "parallel") {
+		algorithm = SAAlgorithm::PARALLEL;
+		return true;
+	}
+	return false;
+}
+
+std::string SAAlgorithmName(SAAlgorithm algorithm) {
+	switch (algorithm) {
+	case SAAlgorithm::GSACAK: return "gsacak";
+	case SAAlgorithm::PARALLEL: return "parallel";
+	default: return "auto";
+	}
+}
+
+SAAlgorithm resolveSAAlgorithm(SAAlgorithm algorithm, uint_t thread_num) {
+	if (algorithm != SAAlgorithm::AUTO) return algorithm;
+	return thread_num >= PARALLEL_SA_MIN_THREADS ? SAAlgorithm::PARALLEL : SAAlgorithm::GSACAK;
+}
+
+void buildSuffixArray(const unsigned char* s, uint_t* SA, int_t* LCP, uint_t n, SAAlgorithm algorithm, uint_t thread_num) {
+	if (algorithm == SAAlgorithm::PARALLEL)
+		parallelSACA(s, SA, LCP, nullptr, n, getMaxValue(thread_num, (uint_t)1));
+	else
+		gsacak(const_cast<unsigned char*>(s), SA, LCP, nullptr, n);
+}
+
+// Sorts data[0..n-1] by sorting `parts` chunks concurrently and merging them pairwise.
+template<typename T>
+static void parallelSort(ThreadPool& pool, uint_t parts, T* data, uint_t n) {
+	if (parts <= 1 || n < PARALLEL_SORT_MIN_SIZE) {
+		std::sort(data, data + n);
+		return;
+	}
+	std::vector<uint_t> bounds;
+	uint_t chunk = (n + parts - 1) / parts;
+	for (uint_t begin = 0; begin < n; begin += chunk) bounds.emplace_back(begin);
+	bounds.emplace_back(n);
+
+	for (size_t i = 0; i + 1 < bounds.size(); ++i) {
+		pool.enqueue([data, &bounds, i]() {
+			std::sort(data + bounds[i], data + bounds[i + 1]);
+			});
+	}
+	pool.waitAllTasksDone();
+
+	// Merge neighbouring runs until a single sorted run is left.
+	while (bounds.size() > 2) {
+		std::vector<uint_t> merged;
+		for (size_t i = 0; i + 2 < bounds.size(); i += 2) {
+			pool.enqueue([data, &bounds, i]() {
+				std::inplace_merge(data + bounds[i], data + bounds[i + 1], data + bounds[i + 2]);
+				});
+			merged.emplace_back(bounds[i]);
+		}
+		if (bounds.size() % 2 == 0) merged.emplace_back(bounds[bounds.size() - 2]);
+		merged.emplace_back(n);
+		pool.waitAllTasksDone();
+		bounds.swap(merged);
+	}
+}
+
+// Splits the sorted (key, position) pairs sorted[0..m-1] into runs of equal keys.
+// heads[i] receives offset plus the index of the first pair of the run containing pair i,
+// and every run with more than one pair is appended to unsorted as an absolute SA range.
+template<typename Pair>
+static void assignGroups(const Pair* sorted, uint_t m, uint_t offset, uint_t* heads, SuffixGroups& unsorted) {
+	uint_t head = 0;
+	for (uint_t i = 1; i <= m; ++i) {
+		if (i == m || sorted[i].first != sorted[i - 1].first) {
+			if (i - head > 1) unsorted.emplace_back(offset + head, offset + i);
+			for (uint_t j = head; j < i; ++j) heads[j] = offset + head;
+			head = i;
+		}
+	}
+}
+
+// Parallel version of assignGroups for large arrays. Every chunk resolves the runs that start
+// inside it; the run crossing into a chunk is resolved afterwards from the previous chunks.
+template<typename Pair>
+static void assignGroupsParallel(ThreadPool& pool, uint_t parts, const Pair* sorted, uint_t m, uint_t offset, uint_t* heads, SuffixGroups& unsorted) {
+	if (parts <= 1 || m < PARALLEL_SORT_MIN_SIZE) {
+		assignGroups(sorted, m, offset, heads, unsorted);
+		return;
+	}
+	uint_t chunk = (m + parts - 1) / parts;
+	uint_t chunk_num = (m + chunk - 1) / chunk;
+	std::vector<uint_t> first_head(chunk_num), last_head(chunk_num);
+	std::vector<SuffixGroups> local_unsorted(chunk_num);
+
+	auto is_head = [sorted](uint_t i) {
+		return i == 0 || sorted[i].first != sorted[i - 1].first;
+		};
+
+	for (uint_t c = 0; c < chunk_num; ++c) {
+		pool.enqueue([&, c]() {
+			uint_t begin = c * chunk;
+			uint_t end = getMinValue(begin + chunk, m);
+			uint_t i = begin;
+			while (i < end && !is_head(i)) ++i;
+			first_head[c] = i;
+			last_head[c] = end; // end means there is no head inside the chunk
+			uint_t head = i;
+			for (; i < end; ++i) {
+				if (is_head(i)) {
+					if (i > head + 1) local_unsorted[c].emplace_back(offset + head, offset + i);
+					head = i;
+					last_head[c] = i;
+				}
+				heads[i] = offset + head;
+			}
+			});
+	}
+	pool.waitAllTasksDone();
+
+	// Resolve the runs that cross chunk borders.
+	std::vector<uint_t> inherited(chunk_num, 0);
+	uint_t open_head = 0;
+	for (uint_t c = 0; c < chunk_num; ++c) {
+		uint_t end = getMinValue((c + 1) * chunk, m);
+		inherited[c] = open_head;
+		unsorted.insert(unsorted.end(), local_unsorted[c].begin(), local_unsorted[c].end());
+		if (first_head[c] < end) {
+			// The run left open by the previous chunks ends at the first head of this chunk.
+			if (c > 0 && first_head[c] > open_head + 1) unsorted.emplace_back(offset + open_head, offset + first_head[c]);
+			open_head = last_head[c];
+		}
+	}
+	if (m > open_head + 1) unsorted.emplace_back(offset + open_head, offset + m);
+	std::sort(unsorted.begin(), unsorted.end());
+
+	for (uint_t c = 1; c < chunk_num; ++c) {
+		pool.enqueue([&, c]() {
+			for (uint_t i = c * chunk; i < first_head[c]; ++i) heads[i] = offset + inherited[c];
+			});
+	}
+	pool.waitAllTasksDone();
+}
+
+void parallelSACA(const unsigned char* s, uint_t* SA, int_t* LCP, int_da* DA, uint_t n, uint_t thread_num) {
+	thread_num = getMaxValue(thread_num, (uint_t)1);
+	ThreadPool pool(thread_num); // One pool is shared by all phases
+	const uint_t parts = thread_num * 4; // Several chunks per thread to balance the load
+
+	// Separators are ranked by their position, so each one is a unique symbol.
+	std::vector<uint_t> separators;
+	bool used[256] = { false };
+	for (uint_t i = 0; i < n; ++i) {
+		used[s[i]] = true;
+		if (s[i] == 1) separators.emplace_back(i);
+	}
+
+	// Map the text to a dense alphabet: 0 is the terminator, 1..d are the d separators, then the characters.
+	uint_t code[256] = { 0 };
+	uint_t sigma = separators.size() + 1;
+	for (uint_t c = 2; c < 256; ++c) {
+		if (used[c]) code[c] = sigma++;
+	}
+	auto symbol = [&](uint_t i) -> uint64_t {
+		if (i >= n || s[i] == 0) return 0;
+		if (s[i] == 1) return 1 + (std::lower_bound(separators.begin(), separators.end(), i) - separators.begin());
+		return code[s[i]];
+		};
+
+	uint_t bits = 1;
+	while (bits < 64 && (1ULL << bits) < sigma) ++bits;
+	const uint_t pack = getMaxValue((uint_t)(64 / bits), (uint_t)1); // Symbols packed in the initial key
+	const uint64_t mask = bits * pack >= 64 ? ~0ULL : ((1ULL << (bits * pack)) - 1);
+
+	// Sort all suffixes by their first `pack` symbols.
+	std::vector<uint_t> rank(n), heads(n);
+	SuffixGroups unsorted;
+	{
+		std::vector<std::pair<uint64_t, uint_t>> keyed(n);
+		parallelFor(pool, parts, n, [&](uint_t begin, uint_t end) {
+			uint64_t key = 0;
+			for (uint_t j = 0; j < pack; ++j) key = (key << bits) | symbol(begin + j);
+			for (uint_t i = begin; i < end; ++i) {
+				keyed[i] = std::make_pair(key & mask, i);
+				key = (key << bits) | symbol(i + pack);
+			}
+			});
+		parallelSort(pool, parts, keyed.data(), n);
+		parallelFor(pool, parts, n, [&](uint_t begin, uint_t end) {
+			for (uint_t i = begin; i < end; ++i) SA[i] = keyed[i].second;
+			});
+		assignGroupsParallel(pool, parts, keyed.data(), n, 0, heads.data(), unsorted);
+	}
+	parallelFor(pool, parts, n, [&](uint_t begin, uint_t end) {
+		for (uint_t i = begin; i < end; ++i) rank[SA[i]] = heads[i];
+		});
+
+	// Prefix doubling: refine every unsorted group by the rank of the suffix h symbols ahead.
+	uint_t h = pack;
+	uint_t rounds = 0;
+	while (!unsorted.empty()) {
+		rounds++;
+		uint_t unsorted_size = 0;
+		for (const auto& group : unsorted) unsorted_size += group.second - group.first;
+		const uint_t large_size = getMaxValue((uint_t)PARALLEL_SORT_MIN_SIZE, unsorted_size / parts);
+
+		auto second_key = [&](uint_t pos) {
+			return pos + h < n ? rank[pos + h] : 0;
+			};
+
+		SuffixGroups next_unsorted;
+		std::vector<SuffixGroup> small_groups;
+		for (const auto& group : unsorted) {
+			uint_t left = group.first, len = group.second - group.first;
+			if (len < large_size) {
+				small_groups.emplace_back(group);
+				continue;
+			}
+			// Large groups are sorted with all threads.
+			std::vector<std::pair<uint_t, uint_t>> keyed(len);
+			parallelFor(pool, parts, len, [&](uint_t begin, uint_t end) {
+				for (uint_t i = begin; i < end; ++i) keyed[i] = std::make_pair(second_key(SA[left + i]), SA[left + i]);
+				});
+			parallelSort(pool, parts, keyed.data(), len);
+			parallelFor(pool, parts, len, [&](uint_t begin, uint_t end) {
+				for (uint_t i = begin; i < end; ++i) SA[left + i] = keyed[i].second;
+				});
+			assignGroupsParallel(pool, parts, keyed.data(), len, left, heads.data() + left, next_unsorted);
+		}
+
+		// Small groups are distributed over the threads in batches of similar total size.
+		std::vector<std::pair<uint_t, uint_t>> batches; // [first group, last group) of each batch
+		uint_t batch_size = getMaxValue(unsorted_size / parts, (uint_t)1), cur_size = 0, batch_begin = 0;
+		for (uint_t g = 0; g < small_groups.size(); ++g) {
+			cur_size += small_groups[g].second - small_groups[g].first;
+			if (cur_size >= batch_size || g + 1 == small_groups.size()) {
+				batches.emplace_back(batch_begin, g + 1);
+				batch_begin = g + 1;
+				cur_size = 0;
+			}
+		}
+		std::vector<SuffixGroups> batch_unsorted(batches.size());
+		for (uint_t b = 0; b < batches.size(); ++b) {
+			pool.enqueue([&, b]() {
+				std::vector<std::pair<uint_t, uint_t>> keyed;
+				for (uint_t g = batches[b].first; g < batches[b].second; ++g) {
+					uint_t left = small_groups[g].first, right = small_groups[g].second;
+					keyed.clear();
+					for (uint_t i = left; i < right; ++i) keyed.emplace_back(second_key(SA[i]), SA[i]);
+					std::sort(keyed.begin(), keyed.end());
+					for (uint_t i = left; i < right; ++i) SA[i] = keyed[i - left].second;
+					assignGroups(keyed.data(), right - left, left, heads.data() + left, batch_unsorted[b]);
+				}
+				});
+		}
+		pool.waitAllTasksDone();
+		for (const auto& groups : batch_unsorted) {
+			next_unsorted.insert(next_unsorted.end(), groups.begin(), groups.end());
+		}
+
+		// Publish the new ranks only after all groups of this round have read the old ones.
+		for (uint_t b = 0; b < batches.size(); ++b) {
+			pool.enqueue([&, b]() {
+				for (uint_t g = batches[b].first; g < batches[b].second; ++g) {
+					for (uint_t i = small_groups[g].first; i < small_groups[g].second; ++i) rank[SA[i]] = heads[i];
+				}
+				});
+		}
+		pool.waitAllTasksDone();
+		for (const auto& group : unsorted) {
+			uint_t left = group.first, len = group.second - group.first;
+			if (len < large_size) continue;
+			parallelFor(pool, parts, len, [&](uint_t begin, uint_t end) {
+				for (uint_t i = left + begin; i < left + end; ++i) rank[SA[i]] = heads[i];
+				});
+		}
+
+		unsorted.swap(next_unsorted);
+		if (h > n) break; // All prefixes cover the terminator, so every group is a singleton
+		h *= 2;
+	}
+	logger.debug() << "Parallel suffix sorting finished after " << rounds << " doubling rounds" << std::endl;
+
+	// LCP by the PHI algorithm: PHI[SA[i]] = SA[i - 1], PLCP[SA[i]] = LCP[i].
+	if (LCP) {
+		uint_t* phi = rank.data();
+		uint_t* plcp = heads.data();
+		parallelFor(pool, parts, n, [&](uint_t begin, uint_t end) {
+			for (uint_t i = begin; i < end; ++i) phi[SA[i]] = i > 0 ? SA[i - 1] : n;
+			});
+		// PLCP[i + 1] >= PLCP[i] - 1 holds inside every chunk, and restarting at 0 is always safe.
+		parallelFor(pool, parts, n, [&](uint_t begin, uint_t end) {
+			uint_t l = 0;
+			for (uint_t i = begin; i < end; ++i) {
+				uint_t j = phi[i];
+				if (j == n) {
+					plcp[i] = l = 0;
+					continue;
+				}
+				// Separators are unique symbols, so a common prefix never crosses one.
+				while (i + l < n && j + l < n && s[i + l] == s[j + l] && s[i + l] > 1) ++l;
+				plcp[i] = l;
+				if (l > 0) --l;
+			}
+			});
+		parallelFor(pool, parts, n, [&](uint_t begin, uint_t end) {
+			for (uint_t i = begin; i < end; ++i) LCP[i] = i > 0 ? plcp[SA[i]] : 0;
+			});
+	}
+
+	// The document of a suffix is the number of separators in front of it.
+	if (DA) {
+		parallelFor(pool, parts, n, [&](uint_t begin, uint_t end) {
+			for (uint_t i = begin; i < end; ++i) {
+				DA[i] = std::lower_bound(separators.begin(), separators.end(), SA[i]) - separators.begin();
+			}
+			});
+	}
+}
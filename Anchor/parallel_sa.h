@@ -0,0 +1,62 @@
+/*
+ * Copyright [2024] [MALABZ_UESTC Pinglu Zhang]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+ // Author: Pinglu Zhang
+ // Contact: pingluzhang@outlook.com
+ // Created: 2024-11-04
+#pragma once
+
+#include "gsacak.h"
+#include "logging.h"
+#include "utils.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <vector>
+#include <string>
+
+// Suffix array construction engines supported by AnchorFinder.
+enum class SAAlgorithm {
+	AUTO,     // PARALLEL when enough threads are available, GSACAK otherwise.
+	GSACAK,   // Single-threaded gSACA-K (SA, LCP and DA in one pass).
+	PARALLEL, // Multi-threaded prefix doubling with parallel PHI-based LCP.
+};
+
+// Minimum number of threads for which AUTO selects the parallel engine.
+// With fewer threads the linear-time gSACA-K is faster than prefix doubling.
+#define PARALLEL_SA_MIN_THREADS 8
+
+// Parses the name given on the command line ("auto", "gsacak" or "parallel").
+// Returns false if the name is unknown.
+bool parseSAAlgorithm(const std::string& name, SAAlgorithm& algorithm);
+
+// Returns the printable name of a suffix array construction engine.
+std::string SAAlgorithmName(SAAlgorithm algorithm);
+
+// Resolves AUTO to the engine that is used for the given number of threads.
+SAAlgorithm resolveSAAlgorithm(SAAlgorithm algorithm, uint_t thread_num);
+
+// Computes SA and LCP of s[0..n-1] with the given engine (AUTO must be resolved before).
+// LCP may be nullptr if it is not needed.
+void buildSuffixArray(const unsigned char* s, uint_t* SA, int_t* LCP, uint_t n, SAAlgorithm algorithm, uint_t thread_num);
+
+// Computes SA, LCP and DA of the concatenated text s[0..n-1] using thread_num threads.
+// The input follows the gsacak convention: documents are separated by s[i]=1 and s[n-1]=0.
+// The output is identical to gsacak(s, SA, LCP, DA, n): separators are ordered by their
+// position, LCP values never extend over a separator, and DA[i] is the document of SA[i]
+// (the terminating 0 belongs to a virtual document after the last one).
+// LCP or DA may be nullptr if they are not needed.
+void parallelSACA(const unsigned char* s, uint_t* SA, int_t* LCP, int_da* DA, uint_t n, uint_t thread_num);
@@ -28,7 +28,7 @@ void saveRareMatchPairsToCSV(const RareMatchPairs& pairs, const std::string& fil
     }
 
     // Writes the header row of the CSV file.
-    file << "Index,FirstPos,SecondPos,MatchLength,Weight\n";
+    file << "Index,FirstPos,SecondPos,MatchLength,Weight,MatchCount\n";
 
     // Iterates through each RareMatchPair and writes its data to the CSV file.
     for (size_t i = 0; i < pairs.size(); ++i) {
@@ -38,7 +38,8 @@ void saveRareMatchPairsToCSV(const RareMatchPairs& pairs, const std::string& fil
             << pair.first_pos << ","
             << pair.second_pos - fst_len - 1 << ","
             << pair.match_length << ","
-            << pair.weight << "\n";
+            << pair.weight << ","
+            << pair.match_count << "\n";
     }
 
     file.close(); // Closes the file after writing.
@@ -74,6 +75,7 @@ RareMatchPairs readRareMatchPairsFromCSV(const std::string& filename, uint_t fst
             case 2: pair.second_pos = std::stoull(temp) + fst_len + 1; break; // Parse and adjust the second position.
             case 3: pair.match_length = std::stoull(temp); break; // Parse the match length.
             case 4: pair.weight = std::stoull(temp); break; // Parse the weight.
+            case 5: pair.match_count = std::stoull(temp); break; // Parse the maximum number of rare matches.
             }
         }
 
@@ -85,101 +87,63 @@ RareMatchPairs readRareMatchPairsFromCSV(const std::string& filename, uint_t fst
 }
 
 
-
-
-LCPInterval::LCPInterval(const std::vector<int_t>& LCP_array, uint_t interval_size)
-    : LCP(LCP_array), interval_size(interval_size), left(0), right(interval_size - 1), min_LCP_value(U_MAX) {
-    if (interval_size == 1 && !LCP.empty()) {
-        // Directly assign the value when interval size is 1
-        min_LCP_value = LCP[0];
-    }
-    else {
-        // Use deque to find the minimum LCP value for intervals larger than 1
-        for (uint_t i = 0; i < interval_size && i < LCP.size(); ++i) {
-            while (!min_deque.empty() && LCP[i] < LCP[min_deque.back()]) {
-                min_deque.pop_back();
-            }
-            min_deque.push_back(i);
-        }
-        if (!min_deque.empty()) {
-            min_LCP_value = LCP[min_deque.front()];
+RareMatch& RareMatchMap::assign(uint_t key, uint_t match_length, uint_t first_count, uint_t second_count) {
+    size_t slot = slotOf(key);
+    if (!slots[slot]) {
+        // Keep at most half of the slots in use, so probe sequences stay short
+        if (2 * (matches.size() + 1) > slots.size()) {
+            rehash(2 * slots.size());
+            slot = slotOf(key);
         }
+        matches.emplace_back();
+        slots[slot] = matches.size();
     }
+    RareMatch& match = matches[slots[slot] - 1];
+    match = RareMatch();
+    match.min_key = key;
+    match.match_length = match_length;
+    match.first_count = first_count;
+    match.second_count = second_count;
+    match.pos_offset = pos_pool.size();
+    pos_pool.resize(pos_pool.size() + first_count + second_count);
+    return match;
 }
 
-void LCPInterval::slideRight() {
-    if (right + 1 < LCP.size()) {
-        ++left;
-        ++right;
-
-        if (interval_size == 1) {
-            // For interval size of 1, directly update min_LCP_value without using deque
-            min_LCP_value = LCP[right];
-        }
-        else {
-            // Update the deque for the new interval when interval size is greater than 1
-            while (!min_deque.empty() && min_deque.front() < left) {
-                min_deque.pop_front();
-            }
-            while (!min_deque.empty() && LCP[right] < LCP[min_deque.back()]) {
-                min_deque.pop_back();
-            }
-            min_deque.push_back(right);
-
-            // Update the min_LCP_value
-            if (!min_deque.empty()) {
-                min_LCP_value = LCP[min_deque.front()];
-            }
-        }
+void RareMatchMap::rehash(size_t slot_num) {
+    slots.assign(slot_num, 0);
+    for (size_t i = 0; i < matches.size(); ++i) {
+        slots[slotOf(matches[i].min_key)] = i + 1;
     }
 }
 
-
-// Returns the minimum LCP value within the current interval.
-int_t LCPInterval::getMinLCP() const {
-    return min_LCP_value;
-}
-
-// Determines if the current interval qualifies as a 'rare interval' based on specific criteria.
-bool LCPInterval::isRareInterval() const {
-    // Interval is not rare if the LCP value right before the start is greater or equal to the minimum LCP value...
-    if (left > 0 && static_cast<uint_t>(LCP[left - 1]) >= min_LCP_value)
-        return false;
-    // ...or if the LCP value right after the end is greater or equal to the minimum LCP value.
-    if (right < static_cast<uint_t>(LCP.size()) - 1 && static_cast<uint_t>(LCP[right + 1]) >= min_LCP_value)
-        return false;
-    return true;
-}
-
-// Checks if the right boundary of the interval has reached the end of the LCP array.
-bool LCPInterval::isRightAtEnd() const {
-    return right == LCP.size() - 1;
-}
-
-// Retrieves the left and right boundaries of the current interval.
-std::pair<uint_t, uint_t> LCPInterval::getboundary() const {
-    return std::make_pair(left, right);
+void RareMatchMap::sortByKey() {
+    std::sort(matches.begin(), matches.end(), [](const RareMatch& a, const RareMatch& b) { return a.min_key < b.min_key; });
+    rehash(slots.size());
 }
 
 
 // Constructor for the RareMatchFinder class.
 // Initializes the class members with provided parameters and calculates additional properties.
-RareMatchFinder::RareMatchFinder(unsigned char* _concat_data, // Pointer to the concatenated data array
+RareMatchFinder::RareMatchFinder(const PackedText& _text, // Concatenated data, packed or as bytes
     std::vector<uint_t>& _SA, // Suffix Array
     std::vector<int_t>& _LCP, // Longest Common Prefix array
-    std::vector<int_da>& _DA, // Document Array indicating which sequence a suffix belongs to
     uint_t _first_seq_start, // Start position of the first sequence in the concatenated data
     uint_t _first_seq_len, // Length of the first sequence
     uint_t _second_seq_start, // Start position of the second sequence in the concatenated data
-    uint_t _second_seq_len) // Length of the second sequence
-    : concat_data(_concat_data),
+    uint_t _second_seq_len, // Length of the second sequence
+    uint_t _max_pairs_per_match, // Maximum number of pairs emitted for one rare match, 0 means unlimited
+    uint_t _thread_num) // Number of threads scanning large arrays, 1 for a serial search
+    : text(_text),
     SA(_SA),
     LCP(_LCP),
-    DA(_DA),
     first_seq_start(_first_seq_start),
     first_seq_len(_first_seq_len),
     second_seq_start(_second_seq_start),
-    second_seq_len(_second_seq_len) {
+    second_seq_len(_second_seq_len),
+    max_pairs_per_match(_max_pairs_per_match),
+    thread_num(getMaxValue(_thread_num, (uint_t)1)),
+    pruned_pair_num(0),
+    rare_interval_size(U_MAX) {
     // Compute the minimum sequence length between the first and second sequences.
     min_seq_len = getMinValue(first_seq_len, second_seq_len);
     // Calculate the total length of the concatenated sequence.
@@ -187,10 +151,14 @@ RareMatchFinder::RareMatchFinder(unsigned char* _concat_data, // Pointer to the
 }
 
 // Function to determine the minimum match length from the positions of matches.
-// Takes a vector of match positions and returns the smallest match length.
-uint_t RareMatchFinder::getMinMatchLength(std::vector<uint_t>& match_pos) {
+// Takes the range SA[first..last] of match positions, returns the smallest match length and
+// stores the smallest position in min_pos.
+uint_t RareMatchFinder::getMinMatchLength(uint_t first, uint_t last, uint_t& min_pos) {
     uint_t min_match_length = U_MAX; // Initialize with maximum possible value.
-    for (auto& pos : match_pos) { // Iterate through each match position.
+    min_pos = U_MAX;
+    for (uint_t i = first; i <= last; ++i) { // Iterate through each match position.
+        uint_t pos = SA[i];
+        min_pos = getMinValue(min_pos, pos);
         if (pos >= second_seq_start) {
             // If the match position is within the second sequence, calculate the match length accordingly.
             min_match_length = getMinValue(min_match_length, second_seq_start + second_seq_len - pos);
@@ -204,52 +172,467 @@ uint_t RareMatchFinder::getMinMatchLength(std::vector<uint_t>& match_pos) {
 }
 
 
+// Keeps a rare interval of the given size if no smaller one was kept before.
+static void keepRareInterval(const LCPInterval& interval, uint_t size, uint_t& best_size, std::vector<LCPInterval>& rare_intervals) {
+    if (size < best_size) {
+        best_size = size;
+        rare_intervals.clear();
+    }
+    rare_intervals.push_back(interval);
+}
+
+// Finds the rare intervals in one pass over the LCP array, which walks the lcp-interval tree
+// bottom-up with a stack of the open intervals. Each interval is reported when a smaller LCP value
+// closes it; the LCP values before and after it are then smaller than its minimum, which is the
+// rare interval condition. The stack also counts the suffixes of the second sequence below each
+// open interval, so only intervals occurring in both sequences are kept.
+// Runs ending at the last LCP value are not rare intervals, as no LCP value follows them.
+void RareMatchFinder::scanRareIntervals(uint_t begin, uint_t end, int_t min_value, uint_t& best_size, std::vector<LCPInterval>& rare_intervals) {
+    struct OpenInterval {
+        int_t min_LCP; // Minimum LCP value of the interval.
+        uint_t left; // Left boundary of the interval.
+        uint_t second_count; // Suffixes of the second sequence among SA[left..] added so far.
+    };
+    auto isSecond = [&](uint_t i) -> uint_t { return SA[i] >= second_seq_start; };
+
+    std::vector<OpenInterval> stack;
+    for (uint_t i = begin; i <= end; ++i) {
+        int_t value = i < LCP.size() ? LCP[i] : -1;
+        if (i > begin) stack.back().second_count += isSecond(i - 1);
+
+        uint_t left = i;
+        while (!stack.empty() && stack.back().min_LCP > value) {
+            OpenInterval top = stack.back();
+            stack.pop_back();
+            left = top.left;
+
+            // The interval LCP[left..i - 1] holds the suffixes SA[left - 1..i - 1]
+            uint_t size = i - left;
+            if (i < LCP.size() && top.min_LCP >= min_value && size <= best_size) {
+                uint_t second_count = top.second_count + (left > 0 ? isSecond(left - 1) : 0);
+                uint_t first_count = (left > 0 ? size + 1 : size) - second_count;
+                if (first_count > 0 && second_count > 0) {
+                    keepRareInterval(LCPInterval{ left, i - 1, (uint_t)top.min_LCP, second_count }, size, best_size, rare_intervals);
+                }
+            }
+
+            // The suffixes of the closed interval belong to the interval that encloses it
+            if (!stack.empty() && stack.back().min_LCP >= value) stack.back().second_count += top.second_count;
+            else stack.push_back(OpenInterval{ value, left, top.second_count });
+        }
+        if (stack.empty() || stack.back().min_LCP < value) stack.push_back(OpenInterval{ value, left, 0 });
+    }
+}
+
+// Runs the same stack pass on the split positions only. LCP values between two split positions
+// are at least the split value, so they neither bound nor lower an interval with a smaller
+// minimum: a run of split positions stands for the interval from the position after the split
+// position before it to the position before the split position closing it. The suffixes of the
+// second sequence in that interval follow from the counts before both split positions.
+void RareMatchFinder::scanSplitIntervals(const std::vector<uint_t>& split, const std::vector<uint_t>& second_before, uint_t& best_size, std::vector<LCPInterval>& rare_intervals) {
+    struct OpenRun {
+        int_t min_LCP; // Minimum LCP value of the run.
+        size_t first; // Index of the first split position of the run.
+    };
+
+    std::vector<OpenRun> stack;
+    for (size_t j = 0; j <= split.size(); ++j) {
+        uint_t pos = j < split.size() ? split[j] : LCP.size();
+        int_t value = j < split.size() ? LCP[pos] : -1;
+
+        size_t first = j;
+        while (!stack.empty() && stack.back().min_LCP > value) {
+            OpenRun top = stack.back();
+            stack.pop_back();
+            first = top.first;
+
+            // The interval LCP[left..pos - 1] holds the suffixes SA[left - 1..pos - 1]
+            uint_t left = first > 0 ? split[first - 1] + 1 : 0;
+            uint_t size = pos - left;
+            if (pos < LCP.size() && size <= best_size) {
+                uint_t second_count = second_before[j] - (left > 0 ? second_before[first - 1] : 0);
+                uint_t first_count = (left > 0 ? size + 1 : size) - second_count;
+                if (first_count > 0 && second_count > 0) {
+                    keepRareInterval(LCPInterval{ left, pos - 1, (uint_t)top.min_LCP, second_count }, size, best_size, rare_intervals);
+                }
+            }
+        }
+        if (stack.empty() || stack.back().min_LCP < value) stack.push_back(OpenRun{ value, first });
+    }
+}
+
+// Large arrays are split at the positions whose LCP value is below a small split value, chosen so
+// that there are enough of them to balance the threads. No interval with a minimum of at least the
+// split value contains a split position, so the chunks between split positions are scanned
+// concurrently for those intervals, and one pass over the split positions finds the others.
+// The intervals of the smallest size are then merged in the order of their left boundary, which
+// gives the same result as a single pass.
+std::vector<LCPInterval> RareMatchFinder::findRareIntervals(uint_t max_interval_size) {
+    uint_t best_size = max_interval_size;
+    std::vector<LCPInterval> rare_intervals;
+    uint_t n = LCP.size();
+    if (n < PARALLEL_RARE_MATCH_SIZE || thread_num <= 1) {
+        scanRareIntervals(0, n, 0, best_size, rare_intervals);
+        return rare_intervals;
+    }
+
+    // Count the small LCP values to choose the split value
+    int64_t block_num = (int64_t)thread_num * 4;
+    uint_t block_len = (n + block_num - 1) / block_num;
+    uint64_t min_split_num = (uint64_t)block_num * RARE_SPLITS_PER_CHUNK;
+    std::vector<std::vector<uint_t>> block_counts(block_num, std::vector<uint_t>(RARE_SPLIT_MAX_LCP, 0));
+#pragma omp parallel for schedule(dynamic) num_threads(thread_num)
+    for (int64_t b = 0; b < block_num; ++b) {
+        uint_t end = getMinValue((uint_t)((b + 1) * block_len), n);
+        for (uint_t i = b * block_len; i < end; ++i) {
+            if (LCP[i] < RARE_SPLIT_MAX_LCP) ++block_counts[b][LCP[i]];
+        }
+    }
+    int_t split_value = 0;
+    uint64_t split_num = 0;
+    while (split_value < RARE_SPLIT_MAX_LCP && split_num < min_split_num) {
+        for (int64_t b = 0; b < block_num; ++b) split_num += block_counts[b][split_value];
+        ++split_value;
+    }
+    if (split_num < min_split_num || split_num > n / RARE_SPLITS_PER_CHUNK) {
+        scanRareIntervals(0, n, 0, best_size, rare_intervals);
+        return rare_intervals;
+    }
+
+    // Collect the split positions and the suffixes of the second sequence before each of them
+    std::vector<std::vector<uint_t>> block_split(block_num), block_second(block_num);
+    std::vector<uint_t> block_total(block_num, 0);
+#pragma omp parallel for schedule(dynamic) num_threads(thread_num)
+    for (int64_t b = 0; b < block_num; ++b) {
+        uint_t end = getMinValue((uint_t)((b + 1) * block_len), n);
+        uint_t count = 0;
+        for (uint_t i = b * block_len; i < end; ++i) {
+            if (LCP[i] < split_value) {
+                block_split[b].push_back(i);
+                block_second[b].push_back(count);
+            }
+            count += SA[i] >= second_seq_start;
+        }
+        block_total[b] = count;
+    }
+    std::vector<uint_t> split, second_before;
+    split.reserve(split_num);
+    second_before.reserve(split_num);
+    uint_t count = 0;
+    for (int64_t b = 0; b < block_num; ++b) {
+        for (size_t k = 0; k < block_split[b].size(); ++k) {
+            split.push_back(block_split[b][k]);
+            second_before.push_back(count + block_second[b][k]);
+        }
+        count += block_total[b];
+    }
+    std::vector<std::vector<uint_t>>().swap(block_split);
+    std::vector<std::vector<uint_t>>().swap(block_second);
+
+    // Chunks start at the first split position after an even share of the array
+    std::vector<uint_t> chunk_starts{ 0 };
+    for (int64_t c = 1; c < block_num; ++c) {
+        auto it = std::lower_bound(split.begin(), split.end(), (uint_t)(c * block_len));
+        if (it != split.end() && *it > chunk_starts.back()) chunk_starts.push_back(*it);
+    }
+    chunk_starts.push_back(n);
+
+    int64_t chunk_num = chunk_starts.size() - 1;
+    std::vector<uint_t> chunk_best(chunk_num, max_interval_size);
+    std::vector<std::vector<LCPInterval>> chunk_intervals(chunk_num);
+#pragma omp parallel for schedule(dynamic) num_threads(thread_num)
+    for (int64_t c = 0; c < chunk_num; ++c) {
+        scanRareIntervals(chunk_starts[c], chunk_starts[c + 1], split_value, chunk_best[c], chunk_intervals[c]);
+    }
+    scanSplitIntervals(split, second_before, best_size, rare_intervals);
+
+    // Rare intervals of the same size are disjoint, so every list is already ordered by left boundary
+    for (int64_t c = 0; c < chunk_num; ++c) best_size = getMinValue(best_size, chunk_best[c]);
+    std::vector<LCPInterval> merged;
+    for (int64_t c = 0; c < chunk_num; ++c) {
+        if (chunk_best[c] == best_size) merged.insert(merged.end(), chunk_intervals[c].begin(), chunk_intervals[c].end());
+    }
+    size_t chunk_end = merged.size();
+    for (const LCPInterval& interval : rare_intervals) {
+        if (interval.right - interval.left + 1 == best_size) merged.push_back(interval);
+    }
+    std::inplace_merge(merged.begin(), merged.begin() + chunk_end, merged.end(),
+        [](const LCPInterval& a, const LCPInterval& b) { return a.left < b.left; });
+    return merged;
+}
+
 // Finds rare matches up to a specified maximum count within the LCP array.
+// Only the rare intervals with the smallest number of occurrences that still occur in both
+// sequences are used.
 RareMatchPairs RareMatchFinder::findRareMatch(uint_t max_match_count) {
     // Limit the maximum match count to the minimum sequence length for efficiency.
     max_match_count = getMinValue(max_match_count, min_seq_len);
-    uint_t lcp_interval_size = 0;
-    bool is_match_found = false;
     RareMatchMap rare_match_map; // Stores unique rare matches.
 
-    // Iterate through increasing LCP interval sizes until a match is found or max count is reached.
-    while (!is_match_found && lcp_interval_size < max_match_count && ++lcp_interval_size) {
-        LCPInterval lcp_interval(LCP, lcp_interval_size); // Create an LCP interval.
-
-        // Process the LCP interval to find rare matches.
-        while (!lcp_interval.isRightAtEnd()) {
-            if (lcp_interval.isRareInterval()) { // Check for rare interval condition.
-         
-                std::pair<uint_t, uint_t> boundary = lcp_interval.getboundary();
-
-                // Get match positions and types.
-                std::vector<uint_t> match_pos;
-                std::vector<bool> pos_type;
-                getMatchPosAndType(boundary, match_pos, pos_type);
-
-                // Calculate match length and get boundary for the current interval.
-                uint_t match_length = getMinValue((uint_t)lcp_interval.getMinLCP(), getMinMatchLength(match_pos));
-
-                // Convert match positions to RareMatch object and check counts.
-                RareMatch rare_match(match_length, match_pos, pos_type);
-                if (rare_match.first_count > 0 && rare_match.second_count > 0) {
-                    is_match_found = true; // A match is found.
-                    uint_t min_position = rare_match.min_key;
-                    // Update or add the rare match in the map.
-                    auto it = rare_match_map.find(min_position);
-                    if (it != rare_match_map.end()) {
-                        if(it->second.match_length < match_length)
-                            it->second = rare_match;
-                    } else {
-                        rare_match_map[min_position] = rare_match;
-                    }
-                }
+    std::vector<LCPInterval> rare_intervals = findRareIntervals(max_match_count);
+    rare_interval_size = rare_intervals.empty() ? U_MAX : rare_intervals[0].right - rare_intervals[0].left + 1;
+
+    // Calculate match length and the key of each match from its positions, concurrently for large arrays.
+    std::vector<uint_t> match_lengths(rare_intervals.size()), min_positions(rare_intervals.size());
+#pragma omp parallel for if(thread_num > 1 && LCP.size() >= PARALLEL_RARE_MATCH_SIZE) num_threads(thread_num)
+    for (int64_t k = 0; k < (int64_t)rare_intervals.size(); ++k) {
+        const LCPInterval& lcp_interval = rare_intervals[k];
+        uint_t first = lcp_interval.left > 0 ? lcp_interval.left - 1 : 0;
+        match_lengths[k] = getMinValue(lcp_interval.min_LCP, getMinMatchLength(first, lcp_interval.right, min_positions[k]));
+        min_positions[k] += match_lengths[k];
+    }
+
+    for (size_t k = 0; k < rare_intervals.size(); ++k) {
+        const LCPInterval& lcp_interval = rare_intervals[k];
+        uint_t first = lcp_interval.left > 0 ? lcp_interval.left - 1 : 0;
+        uint_t match_length = match_lengths[k], min_position = min_positions[k];
+
+        // Many intervals share a key, so the match is only built when it enters the map.
+        const RareMatch* stored = rare_match_map.find(min_position);
+        if (stored && stored->match_length >= match_length)
+            continue;
+
+        // Update or add the rare match in the map with its positions.
+        uint_t first_count = lcp_interval.right - first + 1 - lcp_interval.second_count;
+        RareMatch& rare_match = rare_match_map.assign(min_position, match_length, first_count, lcp_interval.second_count);
+        getMatchPosAndType(std::make_pair(lcp_interval.left, lcp_interval.right), rare_match_map, rare_match);
+    }
+
+    return pairRareMatches(rare_match_map);
+}
+
+uint_t RareMatchFinder::kmerLength() const {
+    uint_t bits = text.isPacked() ? 2 : 8;
+    uint_t k = 1;
+    while (k < 64 / bits && (1ULL << (2 * k)) < (uint64_t)first_seq_len + second_seq_len) ++k;
+    return getMinValue(getMinValue(k + 1, 64 / bits), min_seq_len);
+}
+
+// The 2-bit codes of A, C, G and T are bits 1 and 2 of their characters.
+void RareMatchFinder::kmerCodes(uint_t start, uint_t len, uint_t k, std::vector<uint64_t>& codes) const {
+    codes.clear();
+    if (len < k) return;
+    codes.reserve(len - k + 1);
+    uint_t bits = text.isPacked() ? 2 : 8;
+    uint64_t mask = bits * k == 64 ? ~0ULL : (1ULL << (bits * k)) - 1;
+    uint64_t code = 0;
+    for (uint_t i = 0; i < len; ++i) {
+        unsigned char c = text.at(start + i);
+        code = ((code << bits) | (text.isPacked() ? (c >> 1) & 3 : c)) & mask;
+        if (i + 1 >= k) codes.push_back(code);
+    }
+}
+
+// Every position of both sequences is mapped to the index of its k-mer in a local open-addressing
+// table, so equal codes are equal k-mers. The k-mers in both sequences with the fewest occurrences are kept if they occur at
+// most max_match_count + 1 times, which is the size limit of the rare intervals of findRareMatch.
+// The positions of the kept k-mers are grouped per k-mer, and all k-mers of one match extend to
+// the same end, so they share the key of the rare match map.
+RareMatchPairs RareMatchFinder::findKmerMatch(uint_t max_match_count) {
+    max_match_count = getMinValue(max_match_count, min_seq_len);
+    uint_t k = kmerLength();
+    if (k == 0) return {};
+
+    struct KmerCount {
+        uint64_t code; // Characters of the k-mer.
+        uint_t first_count; // Occurrences in the first sequence.
+        uint_t second_count; // Occurrences in the second sequence.
+    };
+    std::vector<KmerCount> kmers;
+    size_t slot_num = 1;
+    while (slot_num < 2 * ((size_t)first_seq_len + second_seq_len)) slot_num <<= 1;
+    std::vector<uint_t> slots(slot_num, 0); // Index into kmers plus one, 0 for a free slot.
+
+    // Index of the k-mer starting at each position of both sequences, U_MAX after the last one.
+    std::vector<uint_t> kmer_of(first_seq_len + second_seq_len, U_MAX);
+    std::vector<uint64_t> codes;
+    auto countKmers = [&](uint_t start, uint_t len, uint_t offset, bool second) {
+        kmerCodes(start, len, k, codes);
+        for (uint_t i = 0; i < codes.size(); ++i) {
+            uint64_t code = codes[i];
+            size_t slot = mixHash(code) & (slot_num - 1);
+            while (slots[slot] && kmers[slots[slot] - 1].code != code) slot = (slot + 1) & (slot_num - 1);
+            if (!slots[slot]) {
+                kmers.push_back(KmerCount{ code, 0, 0 });
+                slots[slot] = kmers.size();
             }
-            lcp_interval.slideRight(); // Move to the next interval.
+            KmerCount& kmer = kmers[slots[slot] - 1];
+            ++(second ? kmer.second_count : kmer.first_count);
+            kmer_of[offset + i] = slots[slot] - 1;
         }
+        };
+    countKmers(first_seq_start, first_seq_len, 0, false);
+    countKmers(second_seq_start, second_seq_len, first_seq_len, true);
+    std::vector<uint_t>().swap(slots);
+
+    uint_t best_count = max_match_count + 2;
+    for (const KmerCount& kmer : kmers) {
+        if (kmer.first_count > 0 && kmer.second_count > 0)
+            best_count = getMinValue(best_count, kmer.first_count + kmer.second_count);
+    }
+    if (best_count > max_match_count + 1) return {};
+    rare_interval_size = best_count - 1;
+
+    // Group the positions of the kept k-mers, first sequence before second sequence, in text order.
+    std::vector<uint_t> offsets(kmers.size() + 1, 0);
+    for (size_t j = 0; j < kmers.size(); ++j) {
+        uint_t count = kmers[j].first_count + kmers[j].second_count;
+        offsets[j + 1] = offsets[j] + (count == best_count && kmers[j].first_count > 0 && kmers[j].second_count > 0 ? count : 0);
+    }
+    std::vector<uint_t> positions(offsets.back());
+    std::vector<uint_t> filled(offsets.begin(), offsets.end() - 1);
+    for (uint_t i = 0; i < kmer_of.size(); ++i) {
+        uint_t j = kmer_of[i];
+        if (j == U_MAX || offsets[j + 1] == offsets[j]) continue;
+        positions[filled[j]++] = i < first_seq_len ? first_seq_start + i : second_seq_start + i - first_seq_len;
     }
 
-    // Expand rare matches to the left and convert them to pairs.
+    RareMatchMap rare_match_map;
+    for (size_t j = 0; j < kmers.size(); ++j) {
+        if (offsets[j + 1] == offsets[j]) continue;
+        const uint_t* match_pos = positions.data() + offsets[j];
+        uint_t pos_num = offsets[j + 1] - offsets[j];
+
+        // Extend the k-mer to the right while all occurrences agree and stay in their sequence.
+        uint_t max_length = U_MAX;
+        for (uint_t p = 0; p < pos_num; ++p) {
+            uint_t end = match_pos[p] >= second_seq_start ? second_seq_start + second_seq_len : first_seq_start + first_seq_len;
+            max_length = getMinValue(max_length, end - match_pos[p]);
+        }
+        uint_t match_length = k;
+        for (bool same = true; same && match_length < max_length; match_length += same) {
+            unsigned char c = text.at(match_pos[0] + match_length);
+            for (uint_t p = 1; p < pos_num && same; ++p) same = text.at(match_pos[p] + match_length) == c;
+        }
+
+        // The first position is the smallest one, as in the keys of findRareMatch.
+        uint_t key = match_pos[0] + match_length;
+        const RareMatch* stored = rare_match_map.find(key);
+        if (stored && stored->match_length >= match_length)
+            continue;
+        RareMatch& rare_match = rare_match_map.assign(key, match_length, kmers[j].first_count, kmers[j].second_count);
+        std::copy(match_pos, match_pos + pos_num, rare_match_map.positions(rare_match));
+    }
+
+    return pairRareMatches(rare_match_map);
+}
+
+// Offsets in the first sequence are scaled onto the second one, and every minimizer is looked up
+// at the occurrences of its k-mer closest to that expected offset, at most REPEAT_MAX_HITS of them
+// within the band. The band is the length difference of both sequences, but at least
+// REPEAT_MIN_BAND. The bin of REPEAT_DIAGONAL_BIN diagonals with the most hits, together with its
+// neighbours, wins the vote, so all copies of a repeat are paired with the same copy offset.
+// The hits on one diagonal are extended to maximal exact matches, each of them only once.
+RareMatchPairs RareMatchFinder::findRepeatMatch() {
+    uint_t k = kmerLength();
+    if (k == 0) return {};
+    std::vector<uint64_t> first_codes, second_codes;
+    kmerCodes(first_seq_start, first_seq_len, k, first_codes);
+    kmerCodes(second_seq_start, second_seq_len, k, second_codes);
+    if (first_codes.size() < REPEAT_MINIMIZER_WINDOW || second_codes.size() < REPEAT_MINIMIZER_WINDOW) return {};
+
+    // Offsets of the k-mers of the second sequence ordered by code, equal codes by offset.
+    std::vector<uint_t> second_offsets(second_codes.size());
+    for (uint_t j = 0; j < second_offsets.size(); ++j) second_offsets[j] = j;
+    std::sort(second_offsets.begin(), second_offsets.end(), [&](uint_t a, uint_t b) {
+        return second_codes[a] != second_codes[b] ? second_codes[a] < second_codes[b] : a < b;
+        });
+    std::vector<uint64_t> sorted_codes(second_offsets.size());
+    for (size_t j = 0; j < second_offsets.size(); ++j) sorted_codes[j] = second_codes[second_offsets[j]];
+    std::vector<uint64_t>().swap(second_codes);
+
+    // Hit of a minimizer: its offsets in both sequences and its distance to the scaled diagonal.
+    struct RepeatHit {
+        int64_t distance;
+        uint_t first, second;
+    };
+    std::vector<RepeatHit> hits;
+    int64_t band = getMaxValue((int64_t)REPEAT_MIN_BAND, std::abs((int64_t)first_seq_len - (int64_t)second_seq_len));
+    auto lookUp = [&](uint_t i) {
+        auto range = std::equal_range(sorted_codes.begin(), sorted_codes.end(), first_codes[i]);
+        const uint_t* lo_end = second_offsets.data() + (range.first - sorted_codes.begin());
+        const uint_t* hi_end = second_offsets.data() + (range.second - sorted_codes.begin());
+        int64_t expected = (int64_t)((uint64_t)i * second_seq_len / first_seq_len);
+        const uint_t* hi = std::lower_bound(lo_end, hi_end, (uint_t)expected);
+        const uint_t* lo = hi;
+        for (uint_t n = 0; n < REPEAT_MAX_HITS; ++n) {
+            int64_t below = lo > lo_end ? expected - lo[-1] : band + 1;
+            int64_t above = hi < hi_end ? hi[0] - expected : band + 1;
+            if (below > band && above > band) break;
+            if (below <= above) {
+                --lo;
+                hits.push_back(RepeatHit{ -below, i, *lo });
+            }
+            else {
+                hits.push_back(RepeatHit{ above, i, *hi });
+                ++hi;
+            }
+        }
+        };
+
+    // Minimizers are the k-mers with the smallest hash in each window, taken once per run.
+    uint_t minimizer = U_MAX;
+    for (uint_t s = 0; s + REPEAT_MINIMIZER_WINDOW <= first_codes.size(); ++s) {
+        uint_t last = s + REPEAT_MINIMIZER_WINDOW - 1, best = last;
+        if (minimizer != U_MAX && minimizer >= s) {
+            best = mixHash(first_codes[last]) < mixHash(first_codes[minimizer]) ? last : minimizer;
+        }
+        else {
+            for (uint_t i = s; i < last; ++i) {
+                if (mixHash(first_codes[i]) <= mixHash(first_codes[best])) best = i;
+            }
+        }
+        if (best != minimizer) lookUp(best);
+        minimizer = best;
+    }
+    if (hits.empty()) return {};
+
+    // Vote for the bin of diagonals with the most hits around it.
+    std::vector<uint_t> votes(2 * band / REPEAT_DIAGONAL_BIN + 1, 0);
+    for (const RepeatHit& hit : hits) ++votes[(hit.distance + band) / REPEAT_DIAGONAL_BIN];
+    size_t best_bin = 0;
+    uint_t best_votes = 0;
+    for (size_t b = 0; b < votes.size(); ++b) {
+        uint_t around = votes[b] + (b > 0 ? votes[b - 1] : 0) + (b + 1 < votes.size() ? votes[b + 1] : 0);
+        if (around > best_votes) {
+            best_votes = around;
+            best_bin = b;
+        }
+    }
+    hits.erase(std::remove_if(hits.begin(), hits.end(), [&](const RepeatHit& hit) {
+        size_t bin = (hit.distance + band) / REPEAT_DIAGONAL_BIN;
+        return bin + 1 < best_bin || bin > best_bin + 1;
+        }), hits.end());
+
+    // Extend the hits of each diagonal in the order of their offsets, skipping those inside a match.
+    std::sort(hits.begin(), hits.end(), [](const RepeatHit& a, const RepeatHit& b) {
+        int64_t da = (int64_t)a.second - a.first, db = (int64_t)b.second - b.first;
+        return da != db ? da < db : a.first < b.first;
+        });
+    RareMatchPairs rare_match_pairs;
+    int64_t last_diagonal = 0;
+    uint_t covered_end = 0;
+    for (size_t h = 0; h < hits.size(); ++h) {
+        const RepeatHit& hit = hits[h];
+        int64_t diagonal = (int64_t)hit.second - hit.first;
+        if (h > 0 && diagonal == last_diagonal && hit.first < covered_end) continue;
+        uint_t first_pos = first_seq_start + hit.first, second_pos = second_seq_start + hit.second;
+        uint_t left = text.backwardMatch(first_pos, second_pos, getMinValue(hit.first, hit.second));
+        uint_t right = k, max_right = getMinValue(first_seq_len - hit.first, second_seq_len - hit.second);
+        while (right < max_right && text.at(first_pos + right) == text.at(second_pos + right)) ++right;
+        rare_match_pairs.emplace_back(RareMatchPair{ first_pos - left, second_pos - left, left + right, (double)(left + right) });
+        last_diagonal = diagonal;
+        covered_end = hit.first + right;
+    }
+
+    std::sort(rare_match_pairs.begin(), rare_match_pairs.end());
+    return findOptimalPairs(rare_match_pairs);
+}
+
+// Expands the rare matches to the left and converts them to pairs in the order of their keys,
+// then sorts the pairs and chains the optimal ones.
+RareMatchPairs RareMatchFinder::pairRareMatches(RareMatchMap& rare_match_map) {
+    rare_match_map.sortByKey();
     leftExpandRareMatchMap(rare_match_map);
     RareMatchPairs rare_match_pairs = convertMapToPairs(rare_match_map);
 
@@ -262,8 +645,8 @@ RareMatchPairs RareMatchFinder::findRareMatch(uint_t max_match_count) {
 
 // Fills match positions and their types based on the specified boundary within the suffix array.
 void RareMatchFinder::getMatchPosAndType(std::pair<uint_t, uint_t> boundary, // The boundary within the suffix array to consider
-    std::vector<uint_t>& match_pos, // Vector to be filled with match positions
-    std::vector<bool>& pos_type) { // Vector to be filled with position types (indicating sequence origin)
+    RareMatchMap& rare_match_map, // Map whose pool receives the positions
+    RareMatch& rare_match) { // Match the positions are written to
     uint_t left = boundary.first; // Starting position in the suffix array
     uint_t right = boundary.second; // Ending position in the suffix array
 
@@ -272,11 +655,13 @@ void RareMatchFinder::getMatchPosAndType(std::pair<uint_t, uint_t> boundary, //
         left--;
 
     // Iterate through the specified range in the suffix array
+    // Positions of the first sequence fill the match from the front, those of the second one follow them
+    // The origin sequence follows from the position, so no document array is needed
+    uint_t* match_pos = rare_match_map.positions(rare_match);
+    uint_t first = 0, second = rare_match.first_count;
     for (uint_t i = left; i <= right; i++) {
-        // Add the suffix array position to match positions
-        match_pos.emplace_back(SA[i]);
-        // Add the document array position to indicate the match's origin sequence
-        pos_type.emplace_back(DA[i]);
+        if (SA[i] >= second_seq_start) match_pos[second++] = SA[i];
+        else match_pos[first++] = SA[i];
     }
 
     return; // Explicit return for clarity
@@ -285,21 +670,21 @@ void RareMatchFinder::getMatchPosAndType(std::pair<uint_t, uint_t> boundary, //
 // Expands the matches in the rare match map towards the left to increase the match lengths.
 void RareMatchFinder::leftExpandRareMatchMap(RareMatchMap& rare_match_map) { // A map of rare matches to be expanded
     // Iterate over each rare match pair in the map
-    for (auto& pair : rare_match_map) {
-        RareMatch& rare_match = pair.second; // Reference to the current rare match
+    for (RareMatch& rare_match : rare_match_map) {
         // Increase the match's length by expanding it towards the left
         // leftExpand returns the number of positions by which the match can be expanded
-        rare_match.match_length += leftExpand(rare_match.match_pos, rare_match.match_length);
+        rare_match.match_length += leftExpand(rare_match_map.positions(rare_match), rare_match.size(), rare_match.match_length);
     }
 }
 
 
-uint_t RareMatchFinder::leftExpand(std::vector<uint_t>& match_pos, uint_t match_length) {
-    if (match_pos.empty()) return 0; // Guard against empty input.
+uint_t RareMatchFinder::leftExpand(uint_t* match_pos, uint_t pos_num, uint_t match_length) {
+    if (pos_num == 0) return 0; // Guard against empty input.
 
     uint_t max_expand_length = U_MAX;
 
-    for (auto& pos : match_pos) {
+    for (uint_t i = 0; i < pos_num; ++i) {
+        uint_t pos = match_pos[i];
         if (pos >= second_seq_start) {
             max_expand_length = getMinValue(max_expand_length, pos - second_seq_start);
         }
@@ -308,34 +693,16 @@ uint_t RareMatchFinder::leftExpand(std::vector<uint_t>& match_pos, uint_t match_
         } 
     }
 
-    uint_t expand_length = 0;
-    bool all_char_same = true;
-
-    while (expand_length < max_expand_length) {
-        expand_length++; // Move increment here to ensure correct initial value usage.
-        if (match_pos[0] < expand_length) {
-            all_char_same = false;
-            expand_length--;
-            break; // Ensure we don't go before start of concat_data.
-        }
-        unsigned char cur_char = concat_data[match_pos[0] - expand_length];
-        for (uint_t i = 1; i < match_pos.size(); ++i) {
-            // Check bounds for each position.
-            if (match_pos[i] < expand_length || concat_data[match_pos[i] - expand_length] != cur_char) {
-                all_char_same = false;
-                break;
-            }
-        }
-
-        if (!all_char_same) {
-            expand_length--; // Undo the last increment if characters are not the same.
-            break;
-        }
+    // Every occurrence is compared with the first one, word by word for packed texts.
+    // max_expand_length keeps all positions inside their own sequence, so no bound check is needed.
+    uint_t expand_length = max_expand_length;
+    for (uint_t i = 1; i < pos_num && expand_length > 0; ++i) {
+        expand_length = text.backwardMatch(match_pos[0], match_pos[i], expand_length);
     }
 
     // Update match_pos elements correctly using reference.
-    for (uint_t& pos : match_pos) {
-        pos -= expand_length; // Ensure this operation does not cause underflow.
+    for (uint_t i = 0; i < pos_num; ++i) {
+        match_pos[i] -= expand_length; // Ensure this operation does not cause underflow.
     }
 
     return expand_length;
@@ -344,28 +711,54 @@ uint_t RareMatchFinder::leftExpand(std::vector<uint_t>& match_pos, uint_t match_
 
 // Converts the map of rare matches into pairs for further processing.
 // Each pair consists of positions from the first and second sequences, the match length, and a calculated weight.
+// With a limit on the pairs per match, a match with more combinations only keeps the pairs closest to the
+// diagonal of the interval, where the first sequence is scaled onto the second one. Ties keep the earlier pair.
 RareMatchPairs RareMatchFinder::convertMapToPairs(const RareMatchMap& rare_match_map) {
     RareMatchPairs pairs;
 
+    // Candidate pair of a pruned match: distance to the diagonal and the indices of both positions.
+    struct DiagonalPair {
+        uint64_t distance;
+        uint_t i, j;
+    };
+    std::vector<DiagonalPair> candidates;
+    std::vector<unsigned char> keep;
+
     // Iterate through each rare match entry in the map.
-    for (const auto& entry : rare_match_map) {
-        const RareMatch& match = entry.second;
-
-        // Separate positions based on whether they belong to the first or second sequence.
-        std::vector<uint_t> first_seq_positions;
-        std::vector<uint_t> second_seq_positions;
-        for (uint_t i = 0; i < match.match_pos.size(); ++i) {
-            if (!match.pos_type[i]) { // If it's from the first sequence
-                first_seq_positions.emplace_back(match.match_pos[i]);
+    for (const RareMatch& match : rare_match_map) {
+        // Positions of the first sequence come before those of the second sequence.
+        const uint_t* first_seq_positions = rare_match_map.positions(match);
+        const uint_t* second_seq_positions = first_seq_positions + match.first_count;
+
+        // Select the pairs closest to the diagonal if the match has too many of them.
+        uint64_t pair_num = (uint64_t)match.first_count * match.second_count;
+        bool pruned = max_pairs_per_match > 0 && pair_num > max_pairs_per_match;
+        if (pruned) {
+            candidates.clear();
+            for (uint_t i = 0; i < match.first_count; ++i) {
+                uint64_t expected = (uint64_t)(first_seq_positions[i] - first_seq_start) * second_seq_len / first_seq_len;
+                for (uint_t j = 0; j < match.second_count; ++j) {
+                    uint64_t offset = second_seq_positions[j] - second_seq_start;
+                    candidates.push_back(DiagonalPair{ offset > expected ? offset - expected : expected - offset, i, j });
+                }
             }
-            else { // From the second sequence
-                second_seq_positions.emplace_back(match.match_pos[i]);
+            auto closer = [](const DiagonalPair& a, const DiagonalPair& b) {
+                return a.distance != b.distance ? a.distance < b.distance : (a.i != b.i ? a.i < b.i : a.j < b.j);
+                };
+            std::nth_element(candidates.begin(), candidates.begin() + max_pairs_per_match, candidates.end(), closer);
+            keep.assign(pair_num, false);
+            for (uint_t k = 0; k < max_pairs_per_match; ++k) {
+                keep[(uint64_t)candidates[k].i * match.second_count + candidates[k].j] = true;
             }
+            pruned_pair_num += pair_num - max_pairs_per_match;
         }
 
         // Create pairs from every combination of positions from the first and second sequences.
-        for (auto first_pos : first_seq_positions) {
-            for (auto second_pos : second_seq_positions) {
+        for (uint_t i = 0; i < match.first_count; ++i) {
+            uint_t first_pos = first_seq_positions[i];
+            for (uint_t j = 0; j < match.second_count; ++j) {
+                if (pruned && !keep[(uint64_t)i * match.second_count + j]) continue;
+                uint_t second_pos = second_seq_positions[j];
                 // The weight of each pair is calculated based on the match length and the counts of matches in each sequence.
                 // double weight = match.match_length / (match.first_count * match.second_count);
                 double weight = match.match_length / getMinValue(match.first_count, match.second_count);
@@ -408,11 +801,28 @@ RareMatchPairs RareMatchFinder::findOptimalPairs(const RareMatchPairs& rare_matc
     std::vector<int_t> backtracks(rare_match_pairs.size(), -1);
     scores[0] = rare_match_pairs[0].weight; // Base case: first pair's score is its weight.
 
+    // A predecessor j adds at most max(weight, 0.1) to its score, and floating-point addition is
+    // monotone, so j can not raise the score of i once scores[j] + max(weight, 0.1) <= scores[i].
+    // The same holds for all predecessors before j once their largest score passes this test,
+    // and the look-back stops there. Skipped predecessors could only tie, which never replaces
+    // the backtrack, so scores and backtracks are the same as without the bound.
+    bool bounded = rare_match_pairs.size() >= BOUNDED_CHAINING_SIZE;
+    std::vector<double> prefix_max_scores; // Largest score among the pairs 0..j
+    if (bounded) {
+        prefix_max_scores.resize(rare_match_pairs.size());
+        prefix_max_scores[0] = scores[0];
+    }
+
     // Iterate over each pair to calculate scores and find backtracks.
     for (uint_t i = 1; i < rare_match_pairs.size(); ++i) {
         scores[i] = rare_match_pairs[i].weight; // Start with the current pair's weight.
+        double max_gain = getMaxValue(rare_match_pairs[i].weight, 0.1);
         for (int_t j = i - 1; j >= 0; --j) {
-            
+            if (bounded) {
+                if (prefix_max_scores[j] + max_gain <= scores[i]) break;
+                if (scores[j] + max_gain <= scores[i]) continue;
+            }
+
             // Check if current pair can follow the pair at j without overlap and if it improves the score.
             if (rare_match_pairs[i].first_pos >= rare_match_pairs[j].first_pos + rare_match_pairs[j].match_length &&
                 rare_match_pairs[i].second_pos >= rare_match_pairs[j].second_pos + rare_match_pairs[j].match_length) {
@@ -430,6 +840,7 @@ RareMatchPairs RareMatchFinder::findOptimalPairs(const RareMatchPairs& rare_matc
                 }
             }
         }
+        if (bounded) prefix_max_scores[i] = getMaxValue(prefix_max_scores[i - 1], scores[i]);
     }
 
     // Find the index of the maximum score to start backtracking from.
@@ -21,40 +21,100 @@
 
 #include "logging.h"
 #include "gsacak.h"
+#include "packed_text.h"
 
-#include <deque>
 #include <map>
+#include <omp.h>
 #include <cmath> 
 
 // Structure to represent a rare match, including counts of occurrences in the first and second sequences,
-// the length of the match, positions of the match, and the type of positions (first or second sequence).
+// and the length of the match. Its positions are stored in the position pool of the RareMatchMap that
+// holds it: first_count positions in the first sequence followed by second_count positions in the
+// second sequence, so the sequence of a position follows from its index.
 struct RareMatch {
     uint_t first_count; // Number of occurrences in the first sequence.
     uint_t second_count; // Number of occurrences in the second sequence.
     uint_t match_length; // Length of the match.
-    std::vector<uint_t> match_pos; // Positions of the match.
-    std::vector<bool> pos_type; // Indicates the sequence of each position (0 for first, 1 for second).
+    size_t pos_offset; // Offset of the positions in the position pool.
 
     uint_t min_key; // Minimum key for sorting and identifying unique matches.
 
     // Default constructor initializes counts and min_key to zero and max value, respectively.
-    RareMatch() : first_count(0), second_count(0), match_length(0), min_key(U_MAX) {}
-
-    // Parameterized constructor to initialize the match with specific details.
-    RareMatch(uint_t _match_length, const std::vector<uint_t> _match_pos, const std::vector<bool> _pos_type)
-        : match_length(_match_length), match_pos(_match_pos), pos_type(_pos_type) {
-        // Calculate the minimum key based on position and match length.
-        min_key = *std::min_element(match_pos.begin(), match_pos.end()) + match_length;
-        // Count occurrences in each sequence.
-        first_count = std::count(pos_type.begin(), pos_type.end(), false);
-        second_count = pos_type.size() - first_count;
-    }
+    RareMatch() : first_count(0), second_count(0), match_length(0), pos_offset(0), min_key(U_MAX) {}
+
+    // Number of positions of the match.
+    uint_t size() const { return first_count + second_count; }
 };
 
-// Alias for a vector of RareMatch objects.
-using RareMatches = std::vector<RareMatch>;
-// Map to associate a unique key with each RareMatch.
-using RareMatchMap = std::map<uint_t, RareMatch>;
+// Initial number of slots of a RareMatchMap, a power of two.
+#define RARE_MATCH_MAP_INITIAL_SLOTS 1024
+
+// Number of suffixes from which findRareMatch scans the LCP array in parallel chunks.
+#define PARALLEL_RARE_MATCH_SIZE (1 << 20)
+// The chunks are split at LCP values below a split value smaller than this bound.
+#define RARE_SPLIT_MAX_LCP 32
+// Number of split positions per chunk needed to choose a split value.
+#define RARE_SPLITS_PER_CHUNK 64
+
+// Number of rare match pairs from which findOptimalPairs bounds its look-back.
+#define BOUNDED_CHAINING_SIZE 256
+
+// findRepeatMatch takes the minimizer of each window of this many k-mers of the first sequence.
+#define REPEAT_MINIMIZER_WINDOW 16
+// Largest number of occurrences in the second sequence looked up for one minimizer.
+#define REPEAT_MAX_HITS 64
+// Smallest distance from the scaled diagonal within which occurrences are looked up.
+#define REPEAT_MIN_BAND 1024
+// Width of the diagonal bins voted on by findRepeatMatch.
+#define REPEAT_DIAGONAL_BIN 64
+
+// Flat map to associate a unique key with each RareMatch.
+// Keys are looked up by linear probing in a power-of-two table of indices into a vector of
+// matches, and the positions of all matches are appended to one shared pool, so no node or
+// vector is allocated per match. Replacing a match leaves its old positions unused in the pool.
+class RareMatchMap {
+private:
+    std::vector<RareMatch> matches; // Stored matches, in insertion order until sortByKey.
+    std::vector<uint_t> slots; // Index into matches plus one for each slot, 0 for a free slot.
+    std::vector<uint_t> pos_pool; // Positions of all matches.
+
+    // Slot holding key, or the free slot where it would be inserted.
+    size_t slotOf(uint_t key) const {
+        size_t mask = slots.size() - 1;
+        size_t slot = mixHash(key) & mask;
+        while (slots[slot] && matches[slots[slot] - 1].min_key != key) slot = (slot + 1) & mask;
+        return slot;
+    }
+
+    // Resizes the table to slot_num slots and reinserts all matches.
+    void rehash(size_t slot_num);
+
+public:
+    explicit RareMatchMap() : slots(RARE_MATCH_MAP_INITIAL_SLOTS, 0) {}
+
+    // Returns the match stored under key, or nullptr if there is none.
+    RareMatch* find(uint_t key) {
+        uint_t index = slots[slotOf(key)];
+        return index ? &matches[index - 1] : nullptr;
+    }
+
+    // Stores a match of the given length and counts under key, replacing the one stored there.
+    // Its positions are then written through positions().
+    RareMatch& assign(uint_t key, uint_t match_length, uint_t first_count, uint_t second_count);
+
+    // Positions of a match, those in the first sequence before those in the second one.
+    uint_t* positions(const RareMatch& match) { return pos_pool.data() + match.pos_offset; }
+    const uint_t* positions(const RareMatch& match) const { return pos_pool.data() + match.pos_offset; }
+
+    // Orders the matches by their key, as iterating a std::map would.
+    void sortByKey();
+
+    size_t size() const { return matches.size(); }
+    std::vector<RareMatch>::iterator begin() { return matches.begin(); }
+    std::vector<RareMatch>::iterator end() { return matches.end(); }
+    std::vector<RareMatch>::const_iterator begin() const { return matches.begin(); }
+    std::vector<RareMatch>::const_iterator end() const { return matches.end(); }
+};
 
 // Structure to represent a pair of matching positions between sequences,
 // including their starting positions, match length, and a weight for scoring.
@@ -63,6 +123,7 @@ struct RareMatchPair {
     uint_t second_pos; // Starting position in the second sequence.
     uint_t match_length; // Length of the match.
     double weight; // Weight for scoring the match pair.
+    uint_t match_count = 0; // Size of the rare interval the pair was found in, the smallest k finding it, 0 for repeat anchors.
 
     // Operator overloading for sorting based on first and second positions.
     bool operator<(const RareMatchPair& other) const {
@@ -97,47 +158,24 @@ using RareMatchPairs = std::vector<RareMatchPair>;
 void saveRareMatchPairsToCSV(const RareMatchPairs& pairs, const std::string& filename, uint_t fst_len);
 RareMatchPairs readRareMatchPairsFromCSV(const std::string& filename, uint_t fst_len);
 
-// Represents an interval within the LCP (Longest Common Prefix) array.
-class LCPInterval {
-private:
-    const std::vector<int_t>& LCP; // Reference to the LCP array.
-    uint_t interval_size; // Size of the interval.
-
-    uint_t left; // Left boundary of the interval.
-    uint_t right; // Right boundary of the interval.
-
-    std::deque<uint_t> min_deque; // Deque to maintain the minimum LCP value within the interval.
-    uint_t min_LCP_value; // Cached minimum LCP value in the current interval.
-
-public:
-    // Constructor initializes the interval with a reference to the LCP array and interval size.
-    explicit LCPInterval(const std::vector<int_t>& LCP_array, uint_t interval_size);
-
-    // Moves the interval one position to the right and updates the minimum LCP value.
-    void slideRight();
-
-    // Returns the minimum LCP value within the interval.
-    int_t getMinLCP() const;
-
-    // Checks if the current interval represents a rare interval based on specific criteria.
-    bool isRareInterval() const;
-
-    // Checks if the right boundary of the interval has reached the end of the LCP array.
-    bool isRightAtEnd() const;
-
-    // Returns the boundaries of the current interval.
-    std::pair<uint_t, uint_t> getboundary() const;
+// Represents a rare interval within the LCP (Longest Common Prefix) array: a maximal run
+// LCP[left..right] whose values are all at least its minimum, i.e. an lcp-interval of the
+// suffixes SA[left - 1..right] (SA[0..right] if left is 0).
+struct LCPInterval {
+    uint_t left; // Left boundary of the run.
+    uint_t right; // Right boundary of the run.
+    uint_t min_LCP; // Minimum LCP value within the run.
+    uint_t second_count; // Number of its suffixes in the second sequence.
 };
 
 
 // Finds rare matches within concatenated sequences using LCP array.
 class RareMatchFinder {
 private:
-    unsigned char* concat_data; // Concatenated sequence data.
+    const PackedText& text; // Concatenated sequence data.
 
     std::vector<uint_t> SA; // Suffix Array.
     std::vector<int_t> LCP; // Longest Common Prefix array.
-    std::vector<int_da> DA; // Document Array indicating sequence origin.
 
     uint_t first_seq_start;
     uint_t first_seq_len; // Length of the first sequence.
@@ -148,27 +186,77 @@ private:
     uint_t min_seq_len; // Minimum length of the two sequences.
     uint_t concat_seq_len; // Total length of the concatenated sequence.
 
-    // Retrieves match positions and types from a given boundary.
-    void getMatchPosAndType(std::pair<uint_t, uint_t> boundary, std::vector<uint_t>& match_pos, std::vector<bool>& pos_type);
+    uint_t max_pairs_per_match; // Maximum number of pairs emitted for one rare match, 0 means unlimited.
+    uint_t thread_num; // Number of threads scanning large arrays, 1 for a serial search.
+    uint64_t pruned_pair_num; // Number of pairs dropped by max_pairs_per_match.
+    uint_t rare_interval_size; // Size of the rare intervals of the last search, U_MAX if there was none.
+
+    // Finds the rare intervals of at most max_interval_size LCP values that occur in both sequences,
+    // and keeps those of the smallest size among them, ordered by their left boundary.
+    // Arrays of at least PARALLEL_RARE_MATCH_SIZE entries are scanned in parallel chunks by thread_num threads.
+    std::vector<LCPInterval> findRareIntervals(uint_t max_interval_size);
+
+    // Scans LCP[begin..end] for rare intervals with a minimum of at least min_value that end before end,
+    // and keeps those of the smallest size, which is at most best_size and updated.
+    void scanRareIntervals(uint_t begin, uint_t end, int_t min_value, uint_t& best_size, std::vector<LCPInterval>& rare_intervals);
+
+    // Scans the split positions for the rare intervals that contain one of them. second_before holds
+    // the number of suffixes of the second sequence before each split position.
+    void scanSplitIntervals(const std::vector<uint_t>& split, const std::vector<uint_t>& second_before, uint_t& best_size, std::vector<LCPInterval>& rare_intervals);
+
+    // Writes the match positions from a given boundary to a match of the rare match map, grouped by their type.
+    void getMatchPosAndType(std::pair<uint_t, uint_t> boundary, RareMatchMap& rare_match_map, RareMatch& rare_match);
 
     // Expands rare matches to the left within the rare match map.
     void leftExpandRareMatchMap(RareMatchMap& rare_match_map);
 
     // Expands match positions to the left and returns the number of expanded positions.
-    uint_t leftExpand(std::vector<uint_t>& match_pos, uint_t match_length);
+    uint_t leftExpand(uint_t* match_pos, uint_t pos_num, uint_t match_length);
 
     // Converts the rare match map to pairs for further processing.
     RareMatchPairs convertMapToPairs(const RareMatchMap& rare_match_map);
 
+    // Expands the matches of a filled map to the left and chains their pairs.
+    RareMatchPairs pairRareMatches(RareMatchMap& rare_match_map);
+
+    // Length of the k-mers used by findKmerMatch: one more base than needed to tell all positions
+    // of the interval apart, limited by the bits of a k-mer code and the shorter sequence.
+    uint_t kmerLength() const;
+
+    // Codes of the k-mers starting at start .. start + len - k, 2 bits per base for packed texts
+    // and 8 bits per character otherwise.
+    void kmerCodes(uint_t start, uint_t len, uint_t k, std::vector<uint64_t>& codes) const;
+
     // Finds optimal pairs from given rare match pairs based on specific criteria.
+    // From BOUNDED_CHAINING_SIZE pairs on, predecessors that can not improve a score are not visited.
     RareMatchPairs findOptimalPairs(const RareMatchPairs& rare_match_pairs);
 
-    uint_t getMinMatchLength(std::vector<uint_t>& match_pos);
+    // Returns the smallest match length of the positions SA[first..last] and their smallest position.
+    uint_t getMinMatchLength(uint_t first, uint_t last, uint_t& min_pos);
 
 public:
     // Constructor initializes the finder with concatenated data and associated arrays.
-    explicit RareMatchFinder(unsigned char* _concat_data, std::vector<uint_t>& _SA, std::vector<int_t>& _LCP, std::vector<int_da>& _DA, uint_t _first_seq_start, uint_t _first_seq_len, uint_t _second_seq_start, uint_t _second_seq_len);
+    explicit RareMatchFinder(const PackedText& _text, std::vector<uint_t>& _SA, std::vector<int_t>& _LCP, uint_t _first_seq_start, uint_t _first_seq_len, uint_t _second_seq_start, uint_t _second_seq_len, uint_t _max_pairs_per_match = 0, uint_t _thread_num = 1);
 
     // Finds rare matches up to a specified maximum count.
     RareMatchPairs findRareMatch(uint_t max_match_count = 100);
+
+    // Finds rare matches of small intervals without SA and LCP. The k-mers of both sequences are
+    // counted in a local hash table, and those occurring in both with the smallest count are
+    // extended to the right as far as all their occurrences agree. The matches are then expanded
+    // to the left and chained as in findRareMatch. Rare matches shorter than kmerLength() are missed.
+    RareMatchPairs findKmerMatch(uint_t max_match_count = 100);
+
+    // Finds anchors of an interval without rare matches, such as the copies of a tandem repeat.
+    // Minimizers of the first sequence are looked up near the scaled diagonal of the second one,
+    // the diagonal with the most hits is chosen by voting, and the exact matches around its hits
+    // are chained as rare match pairs weighted by their length.
+    RareMatchPairs findRepeatMatch();
+
+    // Returns the number of pairs dropped by the limit on pairs per match.
+    uint64_t prunedPairNum() const { return pruned_pair_num; }
+
+    // Returns the size of the rare intervals (occurrences minus one) used by the last search,
+    // U_MAX if it found none. This is the smallest max_match_count that finds the same matches.
+    uint_t rareIntervalSize() const { return rare_interval_size; }
 };
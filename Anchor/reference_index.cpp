@@ -0,0 +1,235 @@
+/*
+ * Copyright [2024] [MALABZ_UESTC Pinglu Zhang]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+ // Author: Pinglu Zhang
+ // Contact: pingluzhang@outlook.com
+ // Created: 2024-11-12
+
+#include "reference_index.h"
+
+uint64_t ReferenceIndex::computeKey(const std::string& reference) {
+	return hashString(reference, mixHash(((uint64_t)REFERENCE_INDEX_VERSION << 8) | sizeof(uint_t)));
+}
+
+void ReferenceIndex::build(const unsigned char* ref, uint_t ref_len, uint64_t key, SAAlgorithm algorithm, uint_t thread_num) {
+	this->key = key;
+	this->ref_len = ref_len;
+
+	// Index R 1 0 and drop the suffix of the terminator, which always comes first
+	uint_t n = ref_len + 2;
+	std::vector<unsigned char> text(ref, ref + ref_len);
+	text.push_back(1);
+	text.push_back(0);
+	std::vector<uint_t> full_SA(n);
+	std::vector<int_t> full_LCP(n);
+	buildSuffixArray(text.data(), full_SA.data(), full_LCP.data(), n, algorithm, thread_num);
+	full_LCP[1] = 0;
+	LCP = CompressedLCP(full_LCP.data() + 1, n - 1);
+	std::vector<int_t>().swap(full_LCP);
+	SA = std::vector<uint_t>(full_SA.begin() + 1, full_SA.end());
+	std::vector<uint_t>().swap(full_SA);
+
+	buildBWT(ref);
+}
+
+void ReferenceIndex::buildBWT(const unsigned char* ref) {
+	uint_t m = ref_len + 1;
+	std::vector<unsigned char> chars(m);
+	for (uint_t t = 0; t < m; ++t) {
+		chars[t] = SA[t] ? ref[SA[t] - 1] : 0;
+	}
+
+	// Assign dense codes to the characters of the BWT
+	std::vector<unsigned char> char_codes(256, NO_CODE);
+	sigma = 0;
+	for (unsigned char c : chars) {
+		if (c > 1 && char_codes[c] == NO_CODE) char_codes[c] = sigma++;
+	}
+
+	// Sample the occurrence counts at the start of every block
+	uint_t block_num = m / OCC_SAMPLE_SIZE + 1;
+	std::vector<uint_t> samples((size_t)block_num * sigma, 0);
+	std::vector<uint_t> counts(sigma, 0);
+	for (uint_t t = 0; t < m; ++t) {
+		if (t % OCC_SAMPLE_SIZE == 0) std::copy(counts.begin(), counts.end(), samples.begin() + (size_t)(t / OCC_SAMPLE_SIZE) * sigma);
+		if (chars[t] > 1) ++counts[char_codes[chars[t]]];
+	}
+	if (m % OCC_SAMPLE_SIZE == 0) std::copy(counts.begin(), counts.end(), samples.begin() + (size_t)(m / OCC_SAMPLE_SIZE) * sigma);
+
+	// The suffixes start with the reference characters and the separator
+	std::vector<uint_t> first(257, 0);
+	for (uint_t i = 0; i < ref_len; ++i) ++first[ref[i] + 1];
+	++first[2];
+	for (uint_t c = 1; c < first.size(); ++c) first[c] += first[c - 1];
+
+	bwt = std::move(chars);
+	occ = std::move(samples);
+	C = std::move(first);
+	codes = std::move(char_codes);
+}
+
+uint_t ReferenceIndex::occurrences(unsigned char c, uint_t t) const {
+	unsigned char code = codes[c];
+	if (code == NO_CODE) return 0;
+	uint_t block = t / OCC_SAMPLE_SIZE;
+	uint_t count = occ[(size_t)block * sigma + code];
+	for (uint_t i = block * OCC_SAMPLE_SIZE; i < t; ++i) {
+		count += bwt[i] == c;
+	}
+	return count;
+}
+
+// Merging works in three passes:
+// 1. The query suffixes are sorted on their own. Their order is the same as in the concatenation,
+//    because all of them end at the separator after Q.
+// 2. A backward search computes for every query suffix the number of reference suffixes smaller than it.
+//    A reference suffix that reaches its separator together with a query suffix is smaller, since
+//    gsacak orders separators by position. The two sorted lists are then merged.
+// 3. LCP values are only recomputed next to query suffixes. The LCP with the previous and the next
+//    suffix of consecutive query positions decreases by at most one per step, as in the algorithm of
+//    Kasai et al., so this costs O(|Q|) character comparisons. All other values are copied from the
+//    reference LCP.
+void ReferenceIndex::mergeQuery(const unsigned char* s, uint_t n, uint_t* SA, int_t* LCP, SAAlgorithm algorithm, uint_t thread_num) const {
+	uint_t q_start = ref_len + 1;
+	uint_t q_len = n - ref_len - 3;
+
+	// Sort the suffixes of Q 1 0
+	std::vector<uint_t> q_SA(q_len + 2);
+	buildSuffixArray(s + q_start, q_SA.data(), nullptr, q_len + 2, algorithm, thread_num);
+
+	// Only the separator of R is smaller than the separator of Q
+	std::vector<uint_t> smaller(q_len + 1);
+	smaller[q_len] = 1;
+	for (uint_t j = q_len; j-- > 0;) {
+		unsigned char c = s[q_start + j];
+		smaller[j] = C[c] + occurrences(c, smaller[j + 1]);
+	}
+
+	// Merge both lists behind the terminator; q_SA[0] is the terminator of Q 1 0
+	uint_t m = 0, t = 0;
+	SA[m++] = n - 1;
+	for (uint_t r = 1; r < q_len + 2; ++r) {
+		uint_t j = q_SA[r];
+		while (t < smaller[j]) SA[m++] = this->SA[t++];
+		SA[m++] = q_start + j;
+	}
+	while (t <= ref_len) SA[m++] = this->SA[t++];
+	std::vector<uint_t>().swap(q_SA);
+	std::vector<uint_t>().swap(smaller);
+
+	// Neighbours of the query suffixes; the terminator stands for a missing successor
+	auto isQuery = [&](uint_t p) { return p >= q_start && p + 1 < n; };
+	std::vector<uint_t> prev_lcp(q_len + 1), next_lcp(q_len + 1);
+	for (m = 1; m < n; ++m) {
+		if (!isQuery(SA[m])) continue;
+		prev_lcp[SA[m] - q_start] = SA[m - 1];
+		next_lcp[SA[m] - q_start] = m + 1 < n ? SA[m + 1] : n - 1;
+	}
+
+	// Replace the neighbours by their LCP with the query suffix, from left to right
+	auto neighbourLCP = [&](std::vector<uint_t>& lcp) {
+		uint_t h = 0;
+		for (uint_t j = 0; j <= q_len; ++j) {
+			uint_t p = q_start + j, q = lcp[j];
+			while (s[p + h] == s[q + h] && s[p + h] > 1) ++h;
+			lcp[j] = h;
+			if (h > 0) --h;
+		}
+		};
+	neighbourLCP(prev_lcp);
+	neighbourLCP(next_lcp);
+
+	LCP[0] = 0;
+	t = 0;
+	for (m = 1; m < n; ++m) {
+		if (isQuery(SA[m])) {
+			LCP[m] = prev_lcp[SA[m] - q_start];
+		}
+		else {
+			LCP[m] = isQuery(SA[m - 1]) ? next_lcp[SA[m - 1] - q_start] : this->LCP[t];
+			++t;
+		}
+	}
+}
+
+// Serializes the index; every array is page-aligned so the file can be mapped in place.
+void ReferenceIndex::serialize(std::ostream& out) const {
+	uint32_t version = REFERENCE_INDEX_VERSION, uint_width = sizeof(uint_t);
+	saveArray(out, REFERENCE_INDEX_MAGIC, sizeof(REFERENCE_INDEX_MAGIC));
+	saveNumber(out, version);
+	saveNumber(out, uint_width);
+	saveNumber(out, key);
+	saveNumber(out, ref_len);
+	saveNumber(out, sigma);
+	saveAlignedArray(out, SA);
+	LCP.serialize(out);
+	saveAlignedArray(out, bwt);
+	saveAlignedArray(out, occ);
+	saveAlignedArray(out, C);
+	saveAlignedArray(out, codes);
+}
+
+// Deserializes the index written by serialize into memory.
+void ReferenceIndex::deserialize(std::istream& in) {
+	char magic[sizeof(REFERENCE_INDEX_MAGIC)];
+	uint32_t version, uint_width;
+	loadArray(in, magic, sizeof(magic));
+	loadNumber(in, version);
+	loadNumber(in, uint_width);
+	loadNumber(in, key);
+	loadNumber(in, ref_len);
+	loadNumber(in, sigma);
+	loadAlignedArray(in, SA);
+	LCP.deserialize(in);
+	loadAlignedArray(in, bwt);
+	loadAlignedArray(in, occ);
+	loadAlignedArray(in, C);
+	loadAlignedArray(in, codes);
+}
+
+bool ReferenceIndex::mapFromFile(const std::string& file_name, uint64_t key, uint_t ref_len) {
+	if (!index_file.open(file_name)) return false;
+	MappedReader in(index_file.data(), index_file.size());
+
+	char magic[sizeof(REFERENCE_INDEX_MAGIC)];
+	uint32_t version = 0, uint_width = 0;
+	for (char& c : magic) in.readNumber(c);
+	in.readNumber(version);
+	in.readNumber(uint_width);
+	in.readNumber(this->key);
+	in.readNumber(this->ref_len);
+	in.readNumber(sigma);
+	bool mapped = in.ok() && memcmp(magic, REFERENCE_INDEX_MAGIC, sizeof(magic)) == 0 && version == REFERENCE_INDEX_VERSION
+		&& uint_width == sizeof(uint_t) && this->key == key && this->ref_len == ref_len;
+	if (!mapped) {
+		logger.info() << file_name << " is not a reference index of this reference" << std::endl;
+	}
+	else {
+		uint_t m = ref_len + 1;
+		mapped = in.readArray(SA) && LCP.map(in) && in.readArray(bwt) && in.readArray(occ) && in.readArray(C) && in.readArray(codes)
+			&& SA.size() == m && LCP.size() == m && bwt.size() == m && C.size() == 257 && codes.size() == 256
+			&& occ.size() == (size_t)(m / OCC_SAMPLE_SIZE + 1) * sigma;
+		if (!mapped) logger.info() << file_name << " is truncated or corrupted" << std::endl;
+	}
+	if (!mapped) {
+		SA = MappedArray<uint_t>();
+		LCP = CompressedLCP();
+		index_file.close();
+		return false;
+	}
+	index_file.adviseRandom();
+	return true;
+}
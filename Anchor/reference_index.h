@@ -0,0 +1,94 @@
+/*
+ * Copyright [2024] [MALABZ_UESTC Pinglu Zhang]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+ // Author: Pinglu Zhang
+ // Contact: pingluzhang@outlook.com
+ // Created: 2024-11-12
+#pragma once
+
+#include "gsacak.h"
+#include "logging.h"
+#include "utils.h"
+#include "parallel_sa.h"
+#include "compressed_lcp.h"
+#include "mapped_file.h"
+
+#include <vector>
+#include <string>
+
+// The reference index file starts with this magic and format version.
+#define REFERENCE_INDEX_MAGIC "RaMAref"
+#define REFERENCE_INDEX_VERSION 1
+// Number of BWT entries covered by one occurrence sample.
+#define OCC_SAMPLE_SIZE 64
+// Code of the characters that do not occur in the reference.
+#define NO_CODE 255
+
+// Suffix array of a reference sequence that can be reused for many queries.
+// It indexes the reference text R followed by the separator 1 and the terminator 0, and keeps
+// SA, LCP and the BWT with sampled occurrence counts. mergeQuery derives SA and LCP of the
+// concatenation R 1 Q 1 0 used by AnchorFinder by sorting only the query suffixes and merging them
+// into the reference suffixes with a backward search, so the per-query cost of suffix sorting
+// depends on the query length only.
+class ReferenceIndex : public Serializable {
+private:
+	uint64_t key; // Hash of the reference sequence
+	uint_t ref_len; // Length of the reference sequence
+
+	// Suffixes of R 1 0 without the terminator, i.e. SA[1..] of R 1 0 (ref_len + 1 entries)
+	MappedArray<uint_t> SA;
+	CompressedLCP LCP; // LCP[t] is the LCP of the suffixes t - 1 and t in SA, LCP[0] = 0
+	MappedArray<unsigned char> bwt; // Character before each suffix in SA, 0 for the suffix at position 0
+	MappedArray<uint_t> occ; // occ[b * sigma + code] counts code in bwt[0 .. b * OCC_SAMPLE_SIZE)
+	MappedArray<uint_t> C; // C[c] is the number of suffixes starting with a character smaller than c
+	MappedArray<unsigned char> codes; // Dense code of each character of the BWT, NO_CODE if absent
+	uint_t sigma; // Number of distinct characters in the BWT
+
+	MappedFile index_file; // Mapped reference index when it is loaded from disk
+
+	// Counts the occurrences of c in bwt[0 .. t)
+	uint_t occurrences(unsigned char c, uint_t t) const;
+
+	// Builds the BWT, the occurrence samples and C from the reference text
+	void buildBWT(const unsigned char* ref);
+
+public:
+	explicit ReferenceIndex() : key(0), ref_len(0), sigma(0) {}
+
+	ReferenceIndex(const ReferenceIndex&) = delete;
+	ReferenceIndex& operator=(const ReferenceIndex&) = delete;
+
+	// Computes the key identifying the index of a reference sequence
+	static uint64_t computeKey(const std::string& reference);
+
+	// Builds the index of ref[0..ref_len-1]
+	void build(const unsigned char* ref, uint_t ref_len, uint64_t key, SAAlgorithm algorithm, uint_t thread_num);
+
+	// Maps a saved index in place. Fails if the file belongs to another reference or format version.
+	bool mapFromFile(const std::string& file_name, uint64_t key, uint_t ref_len);
+
+	// Computes SA and LCP of the concatenated text s[0..n-1] = R 1 Q 1 0, where R is the indexed
+	// reference. The result is identical to gsacak(s, SA, LCP, nullptr, n).
+	void mergeQuery(const unsigned char* s, uint_t n, uint_t* SA, int_t* LCP, SAAlgorithm algorithm, uint_t thread_num) const;
+
+	uint_t referenceLength() const { return ref_len; }
+
+	// Serializes the index to an output stream
+	void serialize(std::ostream& out) const override;
+
+	// Deserializes the index from an input stream
+	void deserialize(std::istream& in) override;
+};
@@ -0,0 +1,279 @@
+/*
+ * Copyright [2024] [MALABZ_UESTC Pinglu Zhang]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+ // Author: Pinglu Zhang
+ // Contact: pingluzhang@outlook.com
+ // Created: 2024-11-15
+
+#include "succinct_rmq.h"
+
+#include <limits>
+
+#define SRMQ_WORDS_PER_BLOCK (SRMQ_BLOCK_BITS / 64)
+#define SRMQ_NO_BLOCK std::numeric_limits<uint64_t>::max()
+
+// Excess of all 256 bytes of parentheses, read from the lowest bit, so a block is scanned bytewise.
+struct ExcessTable {
+	int8_t delta[256]; // Excess after all 8 parentheses
+	int8_t min[256]; // Smallest excess after one of the parentheses
+	uint8_t pos[256]; // Rightmost parenthesis reaching the smallest excess
+
+	ExcessTable() {
+		for (int v = 0; v < 256; ++v) {
+			int e = 0, low = 8, at = 0;
+			for (int j = 0; j < 8; ++j) {
+				e += (v >> j) & 1 ? 1 : -1;
+				if (e <= low) {
+					low = e;
+					at = j;
+				}
+			}
+			delta[v] = e;
+			min[v] = low;
+			pos[v] = at;
+		}
+	}
+};
+
+static const ExcessTable excess_table;
+
+SuccinctRMQ::SuccinctRMQ(const CompressedLCP* A, uint_t n) : N(n), bit_num(2 * ((uint64_t)n + 1)), leaf_num(0), LCP(A) {
+	buildParentheses();
+	buildBlocks();
+}
+
+// Every element closes the pending elements with a value not smaller than its own, which are
+// exactly the elements that are not its ancestors, and then opens its own parenthesis.
+void SuccinctRMQ::buildParentheses() {
+	std::vector<uint64_t> words(bit_num / 64 + 1, 0);
+	std::vector<uint64_t> samples;
+	std::vector<int_t> stack;
+	uint64_t p = 0, opened = 0;
+	auto open = [&]() {
+		if (opened % SRMQ_SELECT_SAMPLE == 0) samples.push_back(p / SRMQ_BLOCK_BITS);
+		words[p / 64] |= 1ULL << (p % 64);
+		++p;
+		++opened;
+		};
+
+	open(); // Virtual root
+	for (uint_t i = 0; i < N; ++i) {
+		int_t value = (*LCP)[i];
+		while (!stack.empty() && stack.back() >= value) {
+			stack.pop_back();
+			++p;
+		}
+		open();
+		stack.push_back(value);
+	}
+	// The remaining elements and the root are closed by the zero bits at the end
+
+	bp = std::move(words);
+	select_sample = std::move(samples);
+}
+
+void SuccinctRMQ::buildBlocks() {
+	uint64_t block_num = (bit_num + SRMQ_BLOCK_BITS - 1) / SRMQ_BLOCK_BITS;
+	leaf_num = 1;
+	while (leaf_num < block_num) leaf_num <<= 1;
+
+	std::vector<uint64_t> ranks(block_num + 1);
+	std::vector<int64_t> tree(2 * leaf_num, std::numeric_limits<int64_t>::max());
+	uint64_t opened = 0;
+	for (uint64_t b = 0; b < block_num; ++b) {
+		uint64_t from = b * SRMQ_BLOCK_BITS;
+		uint64_t to = getMinValue(from + SRMQ_BLOCK_BITS, bit_num) - 1;
+		uint64_t pos;
+		ranks[b] = opened;
+		tree[leaf_num + b] = scanMin(from, to, 2 * (int64_t)opened - (int64_t)from, pos);
+		// Bits after the last parenthesis are zero, so whole words can be counted
+		for (uint64_t w = from / 64; w <= to / 64; ++w) opened += __builtin_popcountll(bp[w]);
+	}
+	ranks[block_num] = opened;
+	for (uint64_t node = leaf_num - 1; node >= 1; --node) {
+		tree[node] = getMinValue(tree[2 * node], tree[2 * node + 1]);
+	}
+
+	block_rank = std::move(ranks);
+	min_tree = std::move(tree);
+}
+
+uint64_t SuccinctRMQ::rank(uint64_t p) const {
+	uint64_t b = p / SRMQ_BLOCK_BITS;
+	uint64_t count = block_rank[b];
+	uint64_t w = b * SRMQ_WORDS_PER_BLOCK;
+	for (; w < p / 64; ++w) count += __builtin_popcountll(bp[w]);
+	if (p % 64) count += __builtin_popcountll(bp[w] & ((1ULL << (p % 64)) - 1));
+	return count;
+}
+
+uint64_t SuccinctRMQ::select(uint64_t k) const {
+	// The samples bound the blocks holding the parenthesis, a binary search on the ranks finds it
+	uint64_t s = k / SRMQ_SELECT_SAMPLE;
+	uint64_t lo = select_sample[s];
+	uint64_t hi = s + 1 < select_sample.size() ? select_sample[s + 1] : block_rank.size() - 2;
+	while (lo < hi) {
+		uint64_t mid = (lo + hi + 1) / 2;
+		if (block_rank[mid] <= k) lo = mid;
+		else hi = mid - 1;
+	}
+
+	uint64_t remaining = k - block_rank[lo];
+	uint64_t w = lo * SRMQ_WORDS_PER_BLOCK;
+	while (true) {
+		uint64_t count = __builtin_popcountll(bp[w]);
+		if (remaining < count) break;
+		remaining -= count;
+		++w;
+	}
+	uint64_t word = bp[w];
+	for (; remaining > 0; --remaining) word &= word - 1;
+	return w * 64 + __builtin_ctzll(word);
+}
+
+int64_t SuccinctRMQ::scanMin(uint64_t from, uint64_t to, int64_t excess, uint64_t& pos) const {
+	int64_t best = std::numeric_limits<int64_t>::max();
+	uint64_t p = from;
+	auto step = [&]() {
+		excess += (bp[p / 64] >> (p % 64)) & 1 ? 1 : -1;
+		if (excess <= best) {
+			best = excess;
+			pos = p;
+		}
+		++p;
+		};
+	while (p <= to && p % 8) step();
+	for (; p + 8 <= to + 1; p += 8) {
+		uint8_t byte = (bp[p / 64] >> (p % 64)) & 0xFF;
+		if (excess + excess_table.min[byte] <= best) {
+			best = excess + excess_table.min[byte];
+			pos = p + excess_table.pos[byte];
+		}
+		excess += excess_table.delta[byte];
+	}
+	while (p <= to) step();
+	return best;
+}
+
+uint64_t SuccinctRMQ::rightmostBlock(uint64_t node, uint64_t lo, uint64_t hi, uint64_t first, uint64_t last, int64_t value) const {
+	if (hi < first || lo > last || min_tree[node] > value) return SRMQ_NO_BLOCK;
+	if (lo == hi) return lo;
+	uint64_t mid = (lo + hi) / 2;
+	uint64_t block = rightmostBlock(2 * node + 1, mid + 1, hi, first, last, value);
+	if (block != SRMQ_NO_BLOCK) return block;
+	return rightmostBlock(2 * node, lo, mid, first, last, value);
+}
+
+// The range is split into the partial blocks at both ends and the full blocks in between.
+// Candidates are compared from right to left, so ties keep the rightmost position.
+int64_t SuccinctRMQ::minExcess(uint64_t x, uint64_t y, uint64_t& pos) const {
+	uint64_t bx = x / SRMQ_BLOCK_BITS, by = y / SRMQ_BLOCK_BITS;
+	if (bx == by) return scanMin(x, y, excessBefore(x), pos);
+
+	uint64_t right_start = by * SRMQ_BLOCK_BITS;
+	int64_t best = scanMin(right_start, y, excessBefore(right_start), pos);
+	if (by - bx > 1) {
+		int64_t middle = std::numeric_limits<int64_t>::max();
+		for (uint64_t a = leaf_num + bx + 1, b = leaf_num + by; a < b; a >>= 1, b >>= 1) {
+			if (a & 1) middle = getMinValue(middle, min_tree[a++]);
+			if (b & 1) middle = getMinValue(middle, min_tree[--b]);
+		}
+		if (middle < best) {
+			uint64_t block = rightmostBlock(1, 0, leaf_num - 1, bx + 1, by - 1, middle);
+			uint64_t start = block * SRMQ_BLOCK_BITS;
+			best = scanMin(start, start + SRMQ_BLOCK_BITS - 1, excessBefore(start), pos);
+		}
+	}
+	uint64_t left_pos;
+	int64_t left = scanMin(x, (bx + 1) * SRMQ_BLOCK_BITS - 1, excessBefore(x), left_pos);
+	if (left < best) {
+		best = left;
+		pos = left_pos;
+	}
+	return best;
+}
+
+// The select samples take one word per SRMQ_SELECT_SAMPLE entries and are mostly cached, so reading
+// them here only brings in the blocks the binary searches of select start at.
+void SuccinctRMQ::prefetch(uint_t l, uint_t r) const {
+	if (l == r) return;
+	for (uint64_t k : { (uint64_t)l + 1, (uint64_t)r + 1 }) {
+		uint64_t block = select_sample[k / SRMQ_SELECT_SAMPLE];
+		__builtin_prefetch(&block_rank[block]);
+		__builtin_prefetch(&bp[block * SRMQ_WORDS_PER_BLOCK]);
+	}
+}
+
+// The siblings of a node have non-increasing values from left to right, so the rightmost of the
+// shallowest elements in [l, r] holds the minimum.
+int_t SuccinctRMQ::queryMin(uint_t l, uint_t r) const {
+	if (l > r) std::swap(l, r);
+	if (l == r) return (*LCP)[l];
+	uint64_t x = select((uint64_t)l + 1), y = select((uint64_t)r + 1);
+	uint64_t z;
+	int64_t low = minExcess(x, y, z);
+	if (low >= excessBefore(x) + 1) return (*LCP)[l];
+	return (*LCP)[rank(z + 1) - 1];
+}
+
+size_t SuccinctRMQ::memoryBytes() const {
+	return (bp.size() + block_rank.size() + select_sample.size()) * sizeof(uint64_t) + min_tree.size() * sizeof(int64_t);
+}
+
+// Follows the sizes chosen by buildParentheses and buildBlocks
+size_t SuccinctRMQ::estimateBytes(uint_t n) {
+	uint64_t bit_num = 2 * ((uint64_t)n + 1);
+	uint64_t block_num = (bit_num + SRMQ_BLOCK_BITS - 1) / SRMQ_BLOCK_BITS;
+	uint64_t leaf_num = 1;
+	while (leaf_num < block_num) leaf_num <<= 1;
+	uint64_t sample_num = ((uint64_t)n + SRMQ_SELECT_SAMPLE) / SRMQ_SELECT_SAMPLE;
+	return (bit_num / 64 + 1 + block_num + 1 + sample_num) * sizeof(uint64_t) + 2 * leaf_num * sizeof(int64_t);
+}
+
+// Serializes the structure; the arrays are page-aligned so they can be mapped in place.
+void SuccinctRMQ::serialize(std::ostream& out) const {
+	saveNumber(out, N);
+	saveNumber(out, bit_num);
+	saveNumber(out, leaf_num);
+	saveAlignedArray(out, bp);
+	saveAlignedArray(out, block_rank);
+	saveAlignedArray(out, select_sample);
+	saveAlignedArray(out, min_tree);
+}
+
+// Deserializes the structure written by serialize.
+void SuccinctRMQ::deserialize(std::istream& in) {
+	loadNumber(in, N);
+	loadNumber(in, bit_num);
+	loadNumber(in, leaf_num);
+	loadAlignedArray(in, bp);
+	loadAlignedArray(in, block_rank);
+	loadAlignedArray(in, select_sample);
+	loadAlignedArray(in, min_tree);
+}
+
+// Attaches the arrays written by serialize without copying them.
+// The LCP array has to be set with setLCP before the first query.
+bool SuccinctRMQ::map(MappedReader& in) {
+	if (!in.readNumber(N) || !in.readNumber(bit_num) || !in.readNumber(leaf_num))
+		return false;
+	if (!in.readArray(bp) || !in.readArray(block_rank) || !in.readArray(select_sample) || !in.readArray(min_tree))
+		return false;
+	uint64_t block_num = (bit_num + SRMQ_BLOCK_BITS - 1) / SRMQ_BLOCK_BITS;
+	return bit_num == 2 * ((uint64_t)N + 1) && bp.size() == bit_num / 64 + 1 && block_rank.size() == block_num + 1
+		&& select_sample.size() == ((uint64_t)N + SRMQ_SELECT_SAMPLE) / SRMQ_SELECT_SAMPLE
+		&& leaf_num >= block_num && min_tree.size() == 2 * leaf_num;
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright [2024] [MALABZ_UESTC Pinglu Zhang]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+ // Author: Pinglu Zhang
+ // Contact: pingluzhang@outlook.com
+ // Created: 2024-11-15
+#pragma once
+
+#include "RMQ.h"
+#include "compressed_lcp.h"
+#include "mapped_file.h"
+
+#include <vector>
+
+// Number of parentheses covered by one rank sample and one leaf of the min-excess tree.
+#define SRMQ_BLOCK_BITS 512
+// Number of opening parentheses between two select samples.
+#define SRMQ_SELECT_SAMPLE 512
+// Number of LCP entries scanned in about the time of one query.
+#define SRMQ_SCAN_ENTRIES 512
+
+// Succinct range minimum query structure in the style of Fischer and Heun.
+// The LCP array is represented by the balanced parentheses of its 2d-min-heap: element i becomes
+// a child of the closest element to its left with a smaller value, and a virtual root holds all
+// elements without one. The elements appear in preorder, so element i is the (i + 1)-th opening
+// parenthesis. Between the parentheses of elements l and r, the rightmost position with the
+// smallest excess is followed by the opening parenthesis of the minimum; if no position goes below
+// the depth of l, the minimum is l itself. The parentheses take 2n bits; rank samples, select
+// samples and a tree of block minima of the excess add less than one bit per entry.
+class SuccinctRMQ : public RangeMinQuery {
+private:
+	uint_t N; // Number of LCP entries
+	uint64_t bit_num; // Number of parentheses, 2 * (N + 1)
+	uint64_t leaf_num; // Number of leaves of min_tree, a power of two
+	const CompressedLCP* LCP; // LCP values, read through the compressed accessor
+
+	MappedArray<uint64_t> bp; // Parentheses, bit p of word p / 64 is set for an opening parenthesis
+	MappedArray<uint64_t> block_rank; // Number of opening parentheses before each block
+	MappedArray<uint64_t> select_sample; // Block of every SRMQ_SELECT_SAMPLE-th opening parenthesis
+	MappedArray<int64_t> min_tree; // Segment tree over the smallest excess in each block
+
+	// Builds the parentheses and the select samples with a stack of the pending values
+	void buildParentheses();
+
+	// Builds the rank samples and the tree of block minima
+	void buildBlocks();
+
+	// Number of opening parentheses in bp[0 .. p)
+	uint64_t rank(uint64_t p) const;
+
+	// Position of the k-th opening parenthesis, counted from 0
+	uint64_t select(uint64_t k) const;
+
+	// Excess after bp[p - 1], i.e. opening minus closing parentheses in bp[0 .. p)
+	int64_t excessBefore(uint64_t p) const {
+		return 2 * (int64_t)rank(p) - (int64_t)p;
+	}
+
+	// Scans bp[from .. to] starting with the given excess before from. Returns the smallest excess
+	// after a position in the range and stores the rightmost position reaching it in pos.
+	int64_t scanMin(uint64_t from, uint64_t to, int64_t excess, uint64_t& pos) const;
+
+	// Rightmost block in [first, last] whose smallest excess is at most value
+	uint64_t rightmostBlock(uint64_t node, uint64_t lo, uint64_t hi, uint64_t first, uint64_t last, int64_t value) const;
+
+	// Smallest excess after a position in bp[x .. y] and the rightmost position reaching it
+	int64_t minExcess(uint64_t x, uint64_t y, uint64_t& pos) const;
+
+public:
+	// Default constructor creates an empty structure
+	explicit SuccinctRMQ() : N(0), bit_num(0), leaf_num(0), LCP(nullptr) {}
+
+	// Builds the structure over the LCP array A[0..n-1]
+	explicit SuccinctRMQ(const CompressedLCP* A, uint_t n);
+
+	void setLCP(const CompressedLCP* A) override { LCP = A; }
+
+	// Queries the minimum value in the range [l, r]
+	int_t queryMin(uint_t l, uint_t r) const override;
+
+	// Prefetches the select samples, rank samples and first parenthesis words that the selects of
+	// l + 1 and r + 1 start from
+	void prefetch(uint_t l, uint_t r) const override;
+
+	uint_t scanEntries() const override { return SRMQ_SCAN_ENTRIES; }
+
+	// Returns the number of bytes held by the parentheses and their samples
+	size_t memoryBytes() const override;
+
+	// Returns the number of bytes the structure of n LCP entries will hold, before building it
+	static size_t estimateBytes(uint_t n);
+
+	// Serializes the structure to an output stream
+	void serialize(std::ostream& out) const override;
+
+	// Deserializes the structure from an input stream
+	void deserialize(std::istream& in) override;
+
+	// Uses the structure written by serialize in place from a mapped index file
+	bool map(MappedReader& in) override;
+};
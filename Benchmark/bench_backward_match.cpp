@@ -0,0 +1,110 @@
+/*
+ * Copyright [2024] [MALABZ_UESTC Pinglu Zhang]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+ // Author: Pinglu Zhang
+ // Contact: pingluzhang@outlook.com
+ // Created: 2024-11-10
+
+// Checks PackedText::backwardMatch against a character loop on random periodic texts, then times
+// the left extension between copies of a 171 bp satellite unit, for packed DNA and for byte texts.
+// The kernel is chosen at compile time; the targets bench_backward_match_avx2 and
+// bench_backward_match_swar build the same benchmark with -mavx2 and with NO_SIMD.
+// Usage: bench_backward_match [text length] [extension number] [divergence in 1/10000]
+
+#include "packed_text.h"
+
+#include <chrono>
+#include <cstdio>
+
+Logger logger("bench_backward_match", false, info);
+
+static uint_t naiveBackwardMatch(const std::vector<unsigned char>& text, uint_t a, uint_t b, uint_t max_len) {
+	uint_t k = 0;
+	while (k < max_len) {
+		unsigned char c = text[a - k - 1];
+		if (c <= 1 || c != text[b - k - 1]) break;
+		++k;
+	}
+	return k;
+}
+
+// Periodic texts with point mutations and separators, packed or as bytes.
+static bool checkKernels(std::mt19937& rng) {
+	for (int t = 0; t < 300; ++t) {
+		bool dna = t % 2;
+		const char* alphabet = dna ? "ACGT" : "ACGTNRY";
+		uint_t alphabet_size = dna ? 4 : 7;
+		uint_t n = 1000 + rng() % 5000, period = 1 + rng() % 300;
+		std::vector<unsigned char> unit(period), text(n);
+		for (auto& c : unit) c = alphabet[rng() % alphabet_size];
+		for (uint_t i = 0; i < n; ++i) {
+			text[i] = unit[i % period];
+			if (rng() % 500 == 0) text[i] = alphabet[rng() % alphabet_size];
+			if (rng() % 3000 == 0) text[i] = 1;
+		}
+		text[n - 1] = 0;
+		PackedText packed_text(text.data(), n);
+		for (int q = 0; q < 2000; ++q) {
+			uint_t a = rng() % n, b = rng() % n;
+			if (rng() % 2) b = a >= period ? a - period : a + period;
+			if (b >= n) b = a;
+			uint_t max_len = getMinValue(a, b);
+			if (rng() % 3 == 0) max_len = rng() % (max_len + 1);
+			if (packed_text.backwardMatch(a, b, max_len) != naiveBackwardMatch(text, a, b, max_len)) {
+				printf("backwardMatch(%u, %u, %u) differs from the character loop\n", a, b, max_len);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+int main(int argc, char** argv) {
+	uint_t n = argc > 1 ? std::stoul(argv[1]) : 2000000;
+	size_t extension_num = argc > 2 ? std::stoull(argv[2]) : 200000;
+	uint_t divergence = argc > 3 ? std::stoul(argv[3]) : 20;
+
+	std::mt19937 rng(5);
+	printf("%s kernels\n", PACKED_TEXT_KERNEL);
+	if (!checkKernels(rng)) return 1;
+
+	const uint_t period = 171;
+	for (bool dna : { true, false }) {
+		std::vector<unsigned char> unit(period), text(n);
+		for (auto& c : unit) c = "ACGT"[rng() % 4];
+		for (uint_t i = 0; i < n; ++i) {
+			text[i] = unit[i % period];
+			if (rng() % 10000 < divergence) text[i] = "ACGT"[rng() % 4];
+		}
+		// One N keeps the text in bytes
+		if (!dna) text[5] = 'N';
+		text[n - 1] = 0;
+		PackedText packed_text(text.data(), n);
+
+		std::vector<std::pair<uint_t, uint_t>> extensions(extension_num);
+		for (auto& extension : extensions) {
+			uint_t a = n / 2 + rng() % (n / 2 - 1);
+			extension = std::make_pair(a, a - period * (1 + rng() % 20));
+		}
+		uint64_t bases = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (const auto& extension : extensions) bases += packed_text.backwardMatch(extension.first, extension.second, extension.second);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		printf("%-6s %llu bases per extension, %.3f ns per base\n", packed_text.isPacked() ? "packed" : "bytes",
+			(unsigned long long)(bases / extension_num), seconds * 1e9 / getMaxValue<uint64_t>(bases, 1));
+	}
+	return 0;
+}
@@ -0,0 +1,225 @@
+/*
+ * Copyright [2024] [MALABZ_UESTC Pinglu Zhang]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+ // Author: Pinglu Zhang
+ // Contact: pingluzhang@outlook.com
+ // Created: 2024-11-10
+
+// Times how findRareMatch fills and walks its map of rare matches: RareMatchMap against the
+// std::map of matches owning their positions that it replaced. SA and LCP of a sequence pair are
+// built with gsacak, and its rare intervals are enumerated as findRareMatch does on the root
+// interval: those of at most max match count LCP values that occur in both sequences, of the
+// smallest size among them. Both maps are filled with their real keys, lengths and positions.
+// Without FASTA files, a synthetic pair of tandem repeat arrays stands in for a centromere.
+// Usage: bench_rare_match_map [max match count] [reference FASTA query FASTA | array length]
+
+#include "rare_match.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+Logger logger("bench_rare_match_map", false, info);
+
+// A rare interval reduced to what the map sees.
+struct IntervalMatch {
+	uint_t key;
+	uint_t match_length;
+	uint_t first_count;
+	uint_t second_count;
+	uint_t pos_offset; // First of its positions in the position pool, those of the first sequence first
+};
+
+// The match as the std::map stored it, with its own position and type vectors.
+struct MapRareMatch {
+	uint_t first_count = 0;
+	uint_t second_count = 0;
+	uint_t match_length = 0;
+	std::vector<uint_t> match_pos;
+	std::vector<bool> pos_type;
+};
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Copies of a 12-unit higher-order repeat of a 171 bp monomer with 1% divergence between copies,
+// and the second array with 0.5% divergence from the first, between unique flanks.
+static void makeRepeatPair(uint_t array_len, std::string& first, std::string& second) {
+	std::mt19937_64 rng(11);
+	auto mutate = [&](const std::string& s, uint_t per_mille) {
+		std::string t = s;
+		for (auto& c : t) if (rng() % 1000 < per_mille) c = "ACGT"[rng() % 4];
+		return t;
+		};
+	std::string unit(171, 'A'), flank(5000, 'A');
+	for (auto& c : unit) c = "ACGT"[rng() % 4];
+	for (auto& c : flank) c = "ACGT"[rng() % 4];
+	std::string hor;
+	for (int i = 0; i < 12; ++i) hor += mutate(unit, 80);
+	first = flank;
+	while (first.size() < array_len + flank.size()) first += mutate(hor, 10);
+	first += flank;
+	second = mutate(first, 5);
+}
+
+// Rare intervals of the root interval, as scanned by RareMatchFinder::findRareIntervals, with
+// their keys and match lengths as computed by findRareMatch.
+static std::vector<IntervalMatch> findIntervals(const std::vector<uint_t>& SA, const std::vector<int_t>& LCP, uint_t first_len, uint_t second_len,
+	uint_t max_match_count, std::vector<uint_t>& positions) {
+	uint_t second_start = first_len + 1;
+	uint_t n = SA.size();
+	auto isSecond = [&](uint_t i) -> uint_t { return SA[i] >= second_start; };
+	struct OpenInterval {
+		int_t min_LCP;
+		uint_t left;
+		uint_t second_count;
+	};
+	std::vector<OpenInterval> stack;
+	std::vector<std::pair<uint_t, uint_t>> bounds; // LCP[left..right] of the kept intervals
+	uint_t best_size = getMinValue(max_match_count, getMinValue(first_len, second_len));
+	for (uint_t i = 0; i <= n; ++i) {
+		int_t value = i < n ? LCP[i] : -1;
+		if (i > 0) stack.back().second_count += isSecond(i - 1);
+		uint_t left = i;
+		while (!stack.empty() && stack.back().min_LCP > value) {
+			OpenInterval top = stack.back();
+			stack.pop_back();
+			left = top.left;
+			uint_t size = i - left;
+			if (i < n && top.min_LCP > 0 && size <= best_size) {
+				uint_t second_count = top.second_count + (left > 0 ? isSecond(left - 1) : 0);
+				uint_t first_count = (left > 0 ? size + 1 : size) - second_count;
+				if (first_count > 0 && second_count > 0) {
+					if (size < best_size) bounds.clear();
+					best_size = size;
+					bounds.emplace_back(left, i - 1);
+				}
+			}
+			if (!stack.empty() && stack.back().min_LCP >= value) stack.back().second_count += top.second_count;
+			else stack.push_back(OpenInterval{ value, left, top.second_count });
+		}
+		if (stack.empty() || stack.back().min_LCP < value) stack.push_back(OpenInterval{ value, left, 0 });
+	}
+
+	std::vector<IntervalMatch> intervals;
+	intervals.reserve(bounds.size());
+	for (const auto& bound : bounds) {
+		uint_t first = bound.first > 0 ? bound.first - 1 : 0;
+		uint_t min_LCP = U_MAX, min_pos = U_MAX, match_length = U_MAX, second_count = 0;
+		for (uint_t i = bound.first; i <= bound.second; ++i) min_LCP = getMinValue(min_LCP, (uint_t)LCP[i]);
+		for (uint_t i = first; i <= bound.second; ++i) {
+			min_pos = getMinValue(min_pos, SA[i]);
+			match_length = getMinValue(match_length, isSecond(i) ? second_start + second_len - SA[i] : first_len - SA[i]);
+			second_count += isSecond(i);
+		}
+		match_length = getMinValue(match_length, min_LCP);
+		uint_t offset = positions.size();
+		for (uint_t i = first; i <= bound.second; ++i) if (!isSecond(i)) positions.push_back(SA[i]);
+		for (uint_t i = first; i <= bound.second; ++i) if (isSecond(i)) positions.push_back(SA[i]);
+		intervals.push_back(IntervalMatch{ min_pos + match_length, match_length, bound.second - first + 1 - second_count, second_count, offset });
+	}
+	return intervals;
+}
+
+static uint64_t runStdMap(const std::vector<IntervalMatch>& intervals, const std::vector<uint_t>& positions) {
+	std::map<uint_t, MapRareMatch> rare_match_map;
+	for (const auto& interval : intervals) {
+		auto it = rare_match_map.find(interval.key);
+		if (it != rare_match_map.end() && it->second.match_length >= interval.match_length) continue;
+		MapRareMatch rare_match;
+		rare_match.match_length = interval.match_length;
+		rare_match.first_count = interval.first_count;
+		rare_match.second_count = interval.second_count;
+		for (uint_t i = 0; i < interval.first_count + interval.second_count; ++i) {
+			rare_match.match_pos.push_back(positions[interval.pos_offset + i]);
+			rare_match.pos_type.push_back(i >= interval.first_count);
+		}
+		rare_match_map[interval.key] = std::move(rare_match);
+	}
+	uint64_t checksum = 0;
+	for (const auto& entry : rare_match_map) {
+		for (size_t i = 0; i < entry.second.match_pos.size(); ++i)
+			checksum = checksum * 31 + entry.second.match_pos[i] + entry.second.pos_type[i];
+	}
+	return checksum;
+}
+
+static uint64_t runFlatMap(const std::vector<IntervalMatch>& intervals, const std::vector<uint_t>& positions) {
+	RareMatchMap rare_match_map;
+	for (const auto& interval : intervals) {
+		const RareMatch* stored = rare_match_map.find(interval.key);
+		if (stored && stored->match_length >= interval.match_length) continue;
+		RareMatch& rare_match = rare_match_map.assign(interval.key, interval.match_length, interval.first_count, interval.second_count);
+		uint_t* match_pos = rare_match_map.positions(rare_match);
+		for (uint_t i = 0; i < rare_match.size(); ++i) match_pos[i] = positions[interval.pos_offset + i];
+	}
+	rare_match_map.sortByKey();
+	uint64_t checksum = 0;
+	for (const auto& rare_match : rare_match_map) {
+		const uint_t* match_pos = rare_match_map.positions(rare_match);
+		for (uint_t i = 0; i < rare_match.size(); ++i)
+			checksum = checksum * 31 + match_pos[i] + (i >= rare_match.first_count);
+	}
+	return checksum;
+}
+
+int main(int argc, char** argv) {
+	uint_t max_match_count = argc > 1 ? std::stoul(argv[1]) : 100;
+	std::string first, second;
+	if (argc > 3) {
+		std::vector<SequenceInfo> data = readDataPath(argv[2], argv[3]);
+		first = data[0].sequence;
+		second = data[1].sequence;
+	}
+	else {
+		makeRepeatPair(argc > 2 ? std::stoul(argv[2]) : 2000000, first, second);
+	}
+
+	std::string text = first + '\1' + second + '\1';
+	text += '\0';
+	uint_t n = text.size();
+	std::vector<uint_t> SA(n);
+	std::vector<int_t> LCP(n);
+	gsacak((unsigned char*)text.data(), SA.data(), LCP.data(), nullptr, n);
+
+	std::vector<uint_t> positions;
+	std::vector<IntervalMatch> intervals = findIntervals(SA, LCP, first.size(), second.size(), max_match_count, positions);
+	size_t key_num = 0;
+	{
+		std::vector<uint_t> keys;
+		for (const auto& interval : intervals) keys.push_back(interval.key);
+		std::sort(keys.begin(), keys.end());
+		key_num = std::unique(keys.begin(), keys.end()) - keys.begin();
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	uint64_t map_checksum = runStdMap(intervals, positions);
+	double map_seconds = secondsSince(start);
+	start = std::chrono::steady_clock::now();
+	uint64_t flat_checksum = runFlatMap(intervals, positions);
+	double flat_seconds = secondsSince(start);
+
+	printf("%zu + %zu bases, %zu rare intervals of %zu occurrences, %zu keys\n", first.size(), second.size(), intervals.size(),
+		intervals.empty() ? (size_t)0 : (size_t)intervals[0].first_count + intervals[0].second_count, key_num);
+	printf("std::map      %.4f s\n", map_seconds);
+	printf("RareMatchMap  %.4f s\n", flat_seconds);
+	if (map_checksum != flat_checksum) {
+		printf("The matches of the two maps differ\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright [2024] [MALABZ_UESTC Pinglu Zhang]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+ // Author: Pinglu Zhang
+ // Contact: pingluzhang@outlook.com
+ // Created: 2024-11-10
+
+// Times the construction and the queries of LinearSparseTable and SparseTable over the LCP array
+// of a random sequence pair with 2% divergence, the text the anchor search works on.
+// Usage: bench_sparse_table [sequence length] [query number]
+
+#include "RMQ.h"
+
+#include <chrono>
+#include <cstdio>
+
+Logger logger("bench_sparse_table", false, info);
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+	uint_t seq_len = argc > 1 ? std::stoul(argv[1]) : 10000000;
+	size_t query_num = argc > 2 ? std::stoull(argv[2]) : 5000000;
+
+	std::mt19937_64 rng(7);
+	std::string first(seq_len, 'A');
+	for (auto& c : first) c = "ACGT"[rng() % 4];
+	std::string text = first + '\1';
+	for (uint_t i = 0; i < seq_len; ++i) text += rng() % 100 < 2 ? "ACGT"[rng() % 4] : first[i];
+	text += '\1';
+	text += '\0';
+
+	uint_t n = text.size();
+	std::vector<uint_t> SA(n);
+	std::vector<int_t> LCP(n);
+	gsacak((unsigned char*)text.data(), SA.data(), LCP.data(), nullptr, n);
+	CompressedLCP compressed_LCP(LCP.data(), n);
+
+	// Three quarters of the ranges are short, as between neighbouring ranks of a sub suffix array
+	std::vector<std::pair<uint_t, uint_t>> queries(query_num);
+	for (auto& query : queries) {
+		uint_t l = rng() % n;
+		uint_t len = rng() % 4 == 0 ? rng() % n : rng() % 1000;
+		query = std::make_pair(l, getMinValue<uint_t>(n - 1, l + len));
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	LinearSparseTable linear_table(&compressed_LCP, n);
+	double linear_build = secondsSince(start);
+	start = std::chrono::steady_clock::now();
+	int64_t linear_sum = 0;
+	for (const auto& query : queries) linear_sum += linear_table.queryMin(query.first, query.second);
+	double linear_query = secondsSince(start);
+
+	start = std::chrono::steady_clock::now();
+	SparseTable sparse_table(LCP.data(), n);
+	double sparse_build = secondsSince(start);
+	start = std::chrono::steady_clock::now();
+	int64_t sparse_sum = 0;
+	for (const auto& query : queries) sparse_sum += sparse_table.queryMin(query.first, query.second);
+	double sparse_query = secondsSince(start);
+
+	printf("%u suffixes, %zu queries\n", n, query_num);
+	printf("LinearSparseTable  build %.3f s, query %.1f ns, %.1f MB\n", linear_build, linear_query / query_num * 1e9, linear_table.memoryBytes() / (1024.0 * 1024.0));
+	printf("SparseTable        build %.3f s, query %.1f ns\n", sparse_build, sparse_query / query_num * 1e9);
+	if (linear_sum != sparse_sum) {
+		printf("The minima of the two tables differ\n");
+		return 1;
+	}
+	return 0;
+}
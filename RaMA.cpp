@@ -43,9 +43,26 @@ int main(int argc, char** argv) {
 	p.add("-t", "--threads", "Number of threads for the alignment process. Defaults to the number of available cores if unspecified.", Mode::OPTIONAL);
 
 	p.add("-s", "--save", "Saves anchor binary files to the output directory for future use, including SA, LCP, and Linear Sparse Table.", Mode::BOOLEAN);
-	p.add("-l", "--load", "Loads existing anchor binary files from the output directory to skip SA, LCP, and Linear Sparse Table construction.", Mode::BOOLEAN);
+	p.add("-l", "--load", "Maps the existing anchor binary file from the output directory in place to skip SA, LCP, and Linear Sparse Table construction.", Mode::BOOLEAN);
+
+	p.add("-C", "--index_cache", "Shared directory of saved indexes keyed by a hash of both sequences. A matching index is reused automatically, otherwise it is built and stored there.", Mode::OPTIONAL);
+
+	p.add("-R", "--ref_index", "Reference-only index file. It is built and saved on first use and reused by later runs with the same reference, which then only sort the query suffixes. Not used when the arrays are built on disk under --memory_limit.", Mode::OPTIONAL);
+
+	p.add("-A", "--sa_algorithm", "Suffix array construction algorithm: auto, parallel or gsacak. auto uses the multi-threaded engine when at least 8 threads are given. Default is auto.", Mode::OPTIONAL);
+	p.add("-Q", "--rmq", "Range minimum query structure over the LCP array: sparse or succinct. succinct needs about 3 bits per base instead of the linear sparse table, with slower queries; with succinct, dense runs of sub suffix array ranks scan the LCP array instead of querying it, while sparse answers every rank by a query. Default is sparse.", Mode::OPTIONAL);
+
+	p.add("-F", "--filter_children", "Derives the sub suffix arrays of child intervals by filtering the parent's one instead of sorting their ranks from ISA. ISA is then only built to be saved and released early.", Mode::BOOLEAN);
+
+	p.add("-M", "--memory_limit", "Memory budget in GB for the text, SA, LCP, ISA and the RMQ structure. If they need more, SA, LCP and ISA are built in blocks on disk and memory-mapped, and the sparse table is replaced by the succinct RMQ when it does not fit beside them. The sub suffix arrays of the anchor search and the alignment are not counted. Default is unlimited.", Mode::OPTIONAL);
+	p.add("-T", "--tmp_dir", "Scratch directory for the disk-backed arrays used under --memory_limit, which also holds about 24 bytes per base of temporary files while they are built. Defaults to the save directory inside the output directory.", Mode::OPTIONAL);
 
 	p.add("-c", "--max_match_count", "Maximum number of rare matches to use for anchor finding. Altering this value is generally not recommended.", Mode::OPTIONAL);
+	p.add("-D", "--adaptive_match_count", "Raises the maximum number of rare matches of deep intervals, so intervals in repeats still get anchors: an interval of n <= 2048 bases and depth d is searched with --max_match_count times 4096 / n, but at most 2 to the power of d (at most 16 times). Longer intervals are searched with --max_match_count, and only if they have no rare match again with --max_match_count times 2 to the power of d, keeping at most --max_pairs (default --max_match_count) pairs per match. The size of the rare intervals used is recorded in the MatchCount column of the anchor files.", Mode::BOOLEAN);
+	p.add("-P", "--max_pairs", "Maximum number of anchor candidates per rare match. A match with more position pairs keeps those closest to the diagonal of its interval, which bounds the work on highly repetitive arrays. Default is unlimited.", Mode::OPTIONAL);
+	p.add("-K", "--kmer_interval", "Intervals of at most this many bases are anchored by matching k-mers with a hash table instead of sub suffix arrays, which avoids their fixed cost deep in the recursion but misses rare matches shorter than the k-mers. Default is 0, which always uses sub suffix arrays.", Mode::OPTIONAL);
+	p.add("-W", "--wfa_cutoff", "Stops splitting intervals whose wavefront alignment is predicted to be faster than their anchor search. auto measures both on sample intervals of the input before the search; alternatively give the costs in ns as task,cell,task,base: per interval and per cell of wavefront alignment, and per interval and per base of the anchor search. The log reports the costs and the intervals cut off. Default is off.", Mode::OPTIONAL);
+	p.add("-H", "--repeat_anchors", "Anchors intervals without rare matches, such as near-identical repeat copies, by exact matches on the diagonal most of their minimizers vote for, so they are still split before the base-level alignment.", Mode::BOOLEAN);
 
 	p.add("-m", "--match", "Match score for sequence alignment. Lower values favor matching characters. Default is 0.", Mode::OPTIONAL);
 	p.add("-x", "--mismatch", "Mismatch penalty. Higher values penalize mismatches more. Default is 3.", Mode::OPTIONAL);
@@ -69,9 +86,14 @@ int main(int argc, char** argv) {
 	}
 
 	// Initialize variables for storing command line arguments
-	std::string ref_path, query_path, output_path;
-	bool save, load, sam_output, paf_output;
-	uint_t thread_num, max_match_count;
+	std::string ref_path, query_path, output_path, tmp_dir, index_cache_dir, ref_index_path;
+	bool save, load, sam_output, paf_output, filter_children, repeat_anchors, adaptive_match_count;
+	uint_t thread_num, max_match_count, max_pairs, kmer_interval;
+	SAAlgorithm sa_algorithm = SAAlgorithm::AUTO;
+	RMQType rmq_type = RMQType::SPARSE_TABLE;
+	AnchorFinderOptions anchor_options;
+	RecursionCostModel& cost_model = anchor_options.cost_model;
+	size_t memory_budget;
 	int_t match, mismatch, gap_open1, gap_open2, gap_extension1, gap_extension2;
 
 	try {
@@ -82,9 +104,24 @@ int main(int argc, char** argv) {
 		thread_num = args["--threads"].empty() ? std::thread::hardware_concurrency() : std::stoi(args["--threads"]);
 		save = args["--save"] == "1";
 		load = args["--load"] == "1";
+		filter_children = args["--filter_children"] == "1";
+		repeat_anchors = args["--repeat_anchors"] == "1";
+		adaptive_match_count = args["--adaptive_match_count"] == "1";
+		index_cache_dir = args["--index_cache"];
+		ref_index_path = args["--ref_index"];
 		sam_output = args["--sam_output"] == "1";
 		paf_output = args["--paf_output"] == "1";
+		if (!args["--sa_algorithm"].empty() && !parseSAAlgorithm(args["--sa_algorithm"], sa_algorithm))
+			throw std::invalid_argument("unknown suffix array algorithm " + args["--sa_algorithm"]);
+		if (!args["--rmq"].empty() && !parseRMQType(args["--rmq"], rmq_type))
+			throw std::invalid_argument("unknown RMQ structure " + args["--rmq"]);
+		if (!args["--wfa_cutoff"].empty() && !parseCostModel(args["--wfa_cutoff"], cost_model))
+			throw std::invalid_argument("invalid cost model " + args["--wfa_cutoff"]);
+		memory_budget = args["--memory_limit"].empty() ? 0 : (size_t)(std::stod(args["--memory_limit"]) * 1024 * 1024 * 1024);
+		tmp_dir = args["--tmp_dir"];
 		max_match_count = getMaxValue(args["--max_match_count"].empty() ? 100 : std::stoi(args["--max_match_count"]), 2);
+		max_pairs = args["--max_pairs"].empty() ? 0 : std::stoi(args["--max_pairs"]);
+		kmer_interval = args["--kmer_interval"].empty() ? 0 : std::stoi(args["--kmer_interval"]);
 		match = args["--match"].empty() ? 0 : std::stoi(args["--match"]);
 		mismatch = args["--mismatch"].empty() ? 3 : std::stoi(args["--mismatch"]);
 		gap_open1 = args["--gap_open1"].empty() ? 4 : std::stoi(args["--gap_open1"]);
@@ -108,15 +145,35 @@ int main(int argc, char** argv) {
 	RareMatchPairs final_anchors;
 	// Load sequences from the input data path
 	std::vector<SequenceInfo>* data = new std::vector<SequenceInfo>(readDataPath(ref_path.c_str(), query_path.c_str()));
+	// Initialize PairAligner with the parsed arguments; it measures the wavefront costs of the cutoff before the anchor search
+	PairAligner pair_aligner(output_path, match, mismatch, gap_open1, gap_extension1, gap_open2, gap_extension2, thread_num);
+	if (cost_model.calibrate) {
+		Intervals samples = RecursionCostModel::sampleIntervals((*data)[0].seq_len, (*data)[1].seq_len);
+		pair_aligner.measureWavefrontCost(*data, samples, cost_model.wavefront_task_ns, cost_model.wavefront_cell_ns);
+	}
 	{
 		// Initialize AnchorFinder with the provided arguments and find anchors
-		AnchorFinder anchor_finder(*data, output_path.c_str(), thread_num, load, save, max_match_count);
+		anchor_options.thread_num = thread_num;
+		anchor_options.load_from_disk = load;
+		anchor_options.save_to_disk = save;
+		anchor_options.max_match_count = max_match_count;
+		anchor_options.sa_algorithm = sa_algorithm;
+		anchor_options.memory_budget = memory_budget;
+		anchor_options.tmp_dir = tmp_dir;
+		anchor_options.index_cache_dir = index_cache_dir;
+		anchor_options.ref_index_path = ref_index_path;
+		anchor_options.rmq_type = rmq_type;
+		anchor_options.filter_children = filter_children;
+		anchor_options.max_pairs_per_match = max_pairs;
+		anchor_options.kmer_interval_size = kmer_interval;
+		anchor_options.repeat_anchors = repeat_anchors;
+		anchor_options.adaptive_match_count = adaptive_match_count;
+		AnchorFinder anchor_finder(*data, output_path.c_str(), anchor_options);
 		final_anchors = anchor_finder.lanuchAnchorSearching();
 	}
 	// final_anchors.clear();
 	// std::cout << final_anchors.size() << std::endl;
-	// Initialize PairAligner with the parsed arguments and align the sequences
-	PairAligner pair_aligner(output_path, match, mismatch, gap_open1, gap_extension1, gap_open2, gap_extension2, thread_num);
+	// Align the sequences
 	pair_aligner.alignPairSeq(*data, final_anchors, sam_output, paf_output);
 
 	// Log the maximum memory used during the process
@@ -8,6 +8,7 @@
 #include <future>
 #include <functional>
 #include <stdexcept>
+#include <algorithm>
 
 // modified from https://github.com/progschj/ThreadPool.git
 class ThreadPool {
@@ -100,6 +101,24 @@ inline void ThreadPool::waitAllTasksDone() {
     all_tasks_done.wait(lock, [this] { return tasks.empty() && tasks_count == 0; });
 }
 
+// splits [0, n) into at most `parts` chunks of near-equal length and runs func(begin, end)
+// for each chunk in the pool. returns after all tasks of the pool are done, so it must not be
+// called from a task of the same pool.
+template<typename F>
+inline void parallelFor(ThreadPool& pool, size_t parts, size_t n, const F& func)
+{
+    if (n == 0) return;
+    parts = std::max<size_t>(std::min(parts, n), 1);
+    size_t chunk = (n + parts - 1) / parts;
+    for (size_t begin = 0; begin < n; begin += chunk) {
+        size_t end = std::min(begin + chunk, n);
+        pool.enqueue([&func, begin, end]() {
+            func(begin, end);
+            });
+    }
+    pool.waitAllTasksDone();
+}
+
 // the destructor joins all threads
 inline ThreadPool::~ThreadPool()
 {
@@ -0,0 +1,101 @@
+/*
+ * Copyright [2024] [MALABZ_UESTC Pinglu Zhang]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+ // Author: Pinglu Zhang
+ // Contact: pingluzhang@outlook.com
+ // Created: 2024-11-08
+
+#include "mapped_file.h"
+#include "logging.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+bool MappedFile::create(const std::string& file_path, size_t bytes, bool temporary) {
+	close();
+	path = file_path;
+	remove_on_close = temporary;
+	fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		logger.error() << "Cannot create file " << path << ": " << strerror(errno) << std::endl;
+		return false;
+	}
+	length = bytes > 0 ? bytes : 1; // mmap does not accept empty mappings
+	if (ftruncate(fd, length) != 0) {
+		logger.error() << "Cannot resize " << path << " to " << length << " bytes: " << strerror(errno) << std::endl;
+		close();
+		return false;
+	}
+	addr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED) {
+		logger.error() << "Cannot map " << path << ": " << strerror(errno) << std::endl;
+		addr = nullptr;
+		close();
+		return false;
+	}
+	return true;
+}
+
+bool MappedFile::open(const std::string& file_path, bool writable) {
+	close();
+	path = file_path;
+	remove_on_close = false;
+	fd = ::open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+	if (fd < 0) {
+		logger.error() << "Cannot open file " << path << ": " << strerror(errno) << std::endl;
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		logger.error() << "Cannot map empty or unreadable file " << path << std::endl;
+		close();
+		return false;
+	}
+	length = st.st_size;
+	addr = mmap(nullptr, length, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED) {
+		logger.error() << "Cannot map " << path << ": " << strerror(errno) << std::endl;
+		addr = nullptr;
+		close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::close() {
+	if (addr) munmap(addr, length);
+	if (fd >= 0) ::close(fd);
+	if (fd >= 0 && remove_on_close) unlink(path.c_str());
+	addr = nullptr;
+	fd = -1;
+	length = 0;
+}
+
+void MappedFile::adviseSequential() const {
+	if (addr) madvise(addr, length, MADV_SEQUENTIAL);
+}
+
+void MappedFile::adviseRandom() const {
+	if (addr) madvise(addr, length, MADV_RANDOM);
+}
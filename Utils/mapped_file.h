@@ -0,0 +1,222 @@
+/*
+ * Copyright [2024] [MALABZ_UESTC Pinglu Zhang]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+ // Author: Pinglu Zhang
+ // Contact: pingluzhang@outlook.com
+ // Created: 2024-11-08
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+// Arrays in index files start at multiples of this offset, so they are page-aligned in a mapping.
+#define INDEX_PAGE_SIZE 4096
+// Size of a cache line in bytes.
+#define CACHE_LINE_SIZE 64
+
+// A file mapped into memory with mmap.
+// Pages of a mapped file are backed by the file instead of swap, so the kernel can drop them
+// under memory pressure and several processes mapping the same file share the same pages.
+class MappedFile {
+private:
+	std::string path; // Path of the mapped file
+	int fd; // File descriptor, -1 if nothing is mapped
+	void* addr; // Start of the mapping
+	size_t length; // Length of the mapping in bytes
+	bool remove_on_close; // Whether the file is deleted when it is closed
+
+public:
+	explicit MappedFile() : fd(-1), addr(nullptr), length(0), remove_on_close(false) {}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	~MappedFile();
+
+	// Creates (or truncates) a file of the given size and maps it for reading and writing.
+	// Temporary files are deleted again when the mapping is closed.
+	bool create(const std::string& file_path, size_t bytes, bool temporary = true);
+
+	// Maps an existing file. Read-only mappings are shared between processes.
+	bool open(const std::string& file_path, bool writable = false);
+
+	// Unmaps the file and deletes it if it is temporary.
+	void close();
+
+	// Hints the kernel that the mapping will be read sequentially or randomly.
+	void adviseSequential() const;
+	void adviseRandom() const;
+
+	bool isOpen() const { return addr != nullptr; }
+
+	void* data() const { return addr; }
+
+	size_t size() const { return length; }
+
+	const std::string& filePath() const { return path; }
+};
+
+// Allocator that aligns the storage to a cache line.
+template<typename T>
+struct CacheAlignedAllocator {
+	using value_type = T;
+
+	CacheAlignedAllocator() = default;
+
+	template<typename U>
+	CacheAlignedAllocator(const CacheAlignedAllocator<U>&) {}
+
+	T* allocate(size_t n) {
+		return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(CACHE_LINE_SIZE)));
+	}
+
+	void deallocate(T* p, size_t) {
+		::operator delete(p, std::align_val_t(CACHE_LINE_SIZE));
+	}
+
+	template<typename U>
+	bool operator==(const CacheAlignedAllocator<U>&) const { return true; }
+
+	template<typename U>
+	bool operator!=(const CacheAlignedAllocator<U>&) const { return false; }
+};
+
+// Array of an index structure. It either owns its elements, or refers to elements stored in place
+// in a memory-mapped index file. Mapped arrays are read-only; only owned arrays are written.
+// Mapped elements are page-aligned; owned elements are aligned as the allocator provides.
+template<typename T, typename Allocator = std::allocator<T>>
+class MappedArray {
+private:
+	std::vector<T, Allocator> owned; // Elements of an owned array
+	const T* view; // First element, owned.data() or a pointer into a mapping
+	size_t count; // Number of elements
+	bool mapped; // Whether the elements live in a mapping
+
+public:
+	explicit MappedArray() : view(nullptr), count(0), mapped(false) {}
+
+	MappedArray(const MappedArray& other) : owned(other.owned), count(other.count), mapped(other.mapped) {
+		view = mapped ? other.view : owned.data();
+	}
+
+	MappedArray(MappedArray&& other) noexcept : owned(std::move(other.owned)), count(other.count), mapped(other.mapped) {
+		view = mapped ? other.view : owned.data();
+	}
+
+	MappedArray& operator=(MappedArray other) {
+		owned.swap(other.owned);
+		count = other.count;
+		mapped = other.mapped;
+		view = mapped ? other.view : owned.data();
+		return *this;
+	}
+
+	// Takes over the elements of a vector
+	MappedArray& operator=(std::vector<T, Allocator>&& vec) {
+		owned = std::move(vec);
+		view = owned.data();
+		count = owned.size();
+		mapped = false;
+		return *this;
+	}
+
+	// Replaces the elements with n copies of value
+	void assign(size_t n, const T& value) {
+		owned.assign(n, value);
+		view = owned.data();
+		count = n;
+		mapped = false;
+	}
+
+	// Refers to n elements stored at data, which must outlive the array
+	void attach(const T* data, size_t n) {
+		std::vector<T, Allocator>().swap(owned);
+		view = data;
+		count = n;
+		mapped = true;
+	}
+
+	// Writable access, only valid for owned arrays
+	T& operator[](size_t i) { return const_cast<T*>(view)[i]; }
+
+	const T& operator[](size_t i) const { return view[i]; }
+
+	const T* data() const { return view; }
+
+	const T* begin() const { return view; }
+
+	const T* end() const { return view + count; }
+
+	size_t size() const { return count; }
+
+	bool isMapped() const { return mapped; }
+};
+
+// Reads the numbers and page-aligned arrays written by Serializable::saveAlignedArray from a mapped
+// index file. Arrays are not copied, they refer to the mapping. Reading past the end of the mapping
+// marks the reader as failed instead of touching memory outside of it.
+class MappedReader {
+private:
+	const char* base; // Start of the mapping
+	size_t length; // Length of the mapping in bytes
+	size_t offset; // Current read position
+	bool failed; // Whether a read went past the end of the mapping
+
+public:
+	explicit MappedReader(const void* data, size_t size) : base(static_cast<const char*>(data)), length(size), offset(0), failed(false) {}
+
+	template<typename T>
+	bool readNumber(T& value) {
+		if (failed || length - offset < sizeof(T)) {
+			failed = true;
+			return false;
+		}
+		memcpy(&value, base + offset, sizeof(T));
+		offset += sizeof(T);
+		return true;
+	}
+
+	// Reads the element count, skips the padding to the next page boundary and attaches the elements.
+	template<typename T, typename Allocator>
+	bool readArray(MappedArray<T, Allocator>& array) {
+		uint64_t size;
+		if (!readNumber(size)) return false;
+		size_t start = (offset + INDEX_PAGE_SIZE - 1) / INDEX_PAGE_SIZE * INDEX_PAGE_SIZE;
+		if (start > length || size > (length - start) / sizeof(T)) {
+			failed = true;
+			return false;
+		}
+		array.attach(reinterpret_cast<const T*>(base + start), size);
+		offset = start + size * sizeof(T);
+		return true;
+	}
+
+	// Same as readArray, for arrays that are kept as raw pointers
+	template<typename T>
+	bool readArray(const T*& array, uint64_t& size) {
+		MappedArray<T> view;
+		if (!readArray(view)) return false;
+		array = view.data();
+		size = view.size();
+		return true;
+	}
+
+	bool ok() const { return !failed; }
+};
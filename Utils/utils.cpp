@@ -32,6 +32,17 @@ bool Serializable::saveToFile(const std::string& filename) const {
 	return true;
 }
 
+bool Serializable::saveToFileAtomically(const std::string& filename) const {
+	std::string tmp_name = filename + "." + std::to_string(getpid()) + ".tmp";
+	if (!saveToFile(tmp_name)) return false;
+	if (std::rename(tmp_name.c_str(), filename.c_str()) != 0) {
+		logger.error() << "Cannot rename " << tmp_name << " to " << filename << std::endl;
+		std::remove(tmp_name.c_str());
+		return false;
+	}
+	return true;
+}
+
 bool Serializable::loadFromFile(const std::string& filename) {
 	std::ifstream in(filename, std::ios::binary);
 	if (!in.is_open()) {
@@ -115,8 +126,7 @@ std::vector<SequenceInfo> readDataPath(const char* ref_path, const char* query_p
 void replaceNWithRandomLetter(std::string& s) {
 	if (s.empty()) return; // Do nothing if the string is empty.
 
-	std::random_device rd; // Obtain a random number from hardware.
-	std::mt19937 gen(rd()); // Seed the generator.
+	std::mt19937 gen(N_REPLACEMENT_SEED); // Fixed seed, so repeated runs see the same sequence.
 	std::uniform_int_distribution<> distr(0, 3); // Define the range for nucleotide indices.
 	const char* bases = "ACGT"; // Nucleotide bases.
 
@@ -130,6 +140,22 @@ void replaceNWithRandomLetter(std::string& s) {
 	}
 }
 
+// Hashes the string in 8-byte words; the last partial word is zero-padded.
+uint64_t hashString(const std::string& s, uint64_t seed) {
+	const uint64_t multiplier = 0x9E3779B97F4A7C15ULL;
+	uint64_t h = mixHash(seed ^ (s.size() * multiplier));
+	size_t i = 0;
+	for (; i + 8 <= s.size(); i += 8) {
+		uint64_t word;
+		memcpy(&word, s.data() + i, 8);
+		h = (h ^ mixHash(word)) * multiplier;
+	}
+	uint64_t tail = 0;
+	memcpy(&tail, s.data() + i, s.size() - i);
+	h = (h ^ mixHash(tail)) * multiplier;
+	return mixHash(h);
+}
+
 void ensureDirExists(const std::string& path) {
 	std::filesystem::path fsPath(path);
 
@@ -21,6 +21,7 @@
 #include "gsacak.h"
 #include "kseq.h"
 #include "logging.h"
+#include "mapped_file.h"
 
 #include <filesystem>
 #include <random>
@@ -31,6 +32,9 @@
 
 #define RAMA_VERSION "1.2.0"
 
+// Seed of the generator that replaces N bases
+#define N_REPLACEMENT_SEED 20240129
+
 
 class Serializable {
 public:
@@ -38,6 +42,9 @@ public:
 	virtual void deserialize(std::istream& in) = 0;
 
 	bool saveToFile(const std::string& filename) const;
+	// Writes to a temporary file next to filename and renames it, so processes that map the
+	// previous file keep their pages and no process ever maps a partially written file.
+	bool saveToFileAtomically(const std::string& filename) const;
 	bool loadFromFile(const std::string& filename);
 protected:
 	template<typename T>
@@ -60,6 +67,45 @@ protected:
 		in.read(reinterpret_cast<char*>(array), sizeof(T) * size);
 	}
 
+	// Saves the element count and the elements, padded so that the elements start at a multiple of
+	// INDEX_PAGE_SIZE in the file. Such arrays can be used in place by a MappedReader.
+	template<typename T>
+	void saveAlignedArray(std::ostream& out, const T* array, size_t size) const {
+		static const char padding[INDEX_PAGE_SIZE] = {};
+		uint64_t count = size;
+		saveNumber(out, count);
+		size_t offset = (size_t)out.tellp();
+		out.write(padding, (INDEX_PAGE_SIZE - offset % INDEX_PAGE_SIZE) % INDEX_PAGE_SIZE);
+		saveArray(out, array, size);
+	}
+
+	template<typename T, typename Allocator>
+	void saveAlignedArray(std::ostream& out, const MappedArray<T, Allocator>& array) const {
+		saveAlignedArray(out, array.data(), array.size());
+	}
+
+	// Loads an array written by saveAlignedArray into memory.
+	template<typename T, typename Allocator>
+	void loadAlignedArray(std::istream& in, MappedArray<T, Allocator>& array) {
+		uint64_t count;
+		loadNumber(in, count);
+		size_t offset = (size_t)in.tellg();
+		in.seekg((INDEX_PAGE_SIZE - offset % INDEX_PAGE_SIZE) % INDEX_PAGE_SIZE, std::ios::cur);
+		std::vector<T, Allocator> vec(count);
+		loadArray(in, vec.data(), count);
+		array = std::move(vec);
+	}
+
+	// Loads an array written by saveAlignedArray into a buffer of the given size.
+	template<typename T>
+	void loadAlignedArray(std::istream& in, T* array, size_t size) {
+		uint64_t count;
+		loadNumber(in, count);
+		size_t offset = (size_t)in.tellg();
+		in.seekg((INDEX_PAGE_SIZE - offset % INDEX_PAGE_SIZE) % INDEX_PAGE_SIZE, std::ios::cur);
+		loadArray(in, array, count < size ? (size_t)count : size);
+	}
+
 	template<typename T>
 	void saveVector(std::ostream& out, const std::vector<T>& vec) const {
 		size_t size = vec.size();
@@ -115,8 +161,22 @@ std::vector<SequenceInfo> readDataPath(const char* ref_path, const char* query_p
 
 // Replaces all occurrences of the character 'N' in a given sequence string with a random nucleotide letter (A, C, G, or T).
 // This is useful for dealing with unknown or ambiguous nucleotide bases in DNA sequences.
+// The generator uses a fixed seed, so the same input always yields the same sequence and saved indexes stay valid.
 void replaceNWithRandomLetter(std::string& s);
 
+// Computes a fast 64-bit hash of a string, 8 bytes per step. Not suitable for cryptographic use.
+uint64_t hashString(const std::string& s, uint64_t seed = 0);
+
+// Mixes the bits of a 64-bit value (splitmix64 finalizer).
+inline uint64_t mixHash(uint64_t x) {
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9ULL;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EBULL;
+	x ^= x >> 31;
+	return x;
+}
+
 // Ensures that a directory exists at the specified path. If the directory does not exist, it is created.
 // This function is useful for setting up directories to store output files or logs.
 void ensureDirExists(const std::string& path);